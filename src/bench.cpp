@@ -0,0 +1,207 @@
+///////////////////////////////////////////////////////////////////////////////
+/////////////////////////        bench.cpp       //////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+//
+// Throughput of each stage of the search, in candidates per second, on
+// Google Benchmark. Linked with search.cpp, checkpoint.cpp, near_miss.cpp,
+// jit.cpp and reverse.cpp, and -lbenchmark -lpthread, e.g.
+//
+//   ./bench --benchmark_format=json --benchmark_out=bench.json
+//
+// The stages are measured on their own over expressions of each length, and
+// the whole search over thread counts. All seeds are fixed, so that two runs
+// measure the very same candidates.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "search.h"
+#include "verifier.h"
+#include "integrator.h"
+#include "reverse.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstddef>
+
+
+using namespace integrator;
+
+namespace {
+
+  constexpr unsigned int seed = 4;
+
+  // Candidates measured per stage, cycled through
+  constexpr std::size_t num_samples = 4096;
+
+  // The integrand of test.cpp, x / tan x
+  std::vector<Point> integrand_points()
+  {
+    auto points = std::vector<Point>{};
+    for (double x : {0.2, 0.5, 0.9, 1.5, 2.0}) {
+      points.push_back({x, x / std::tan(x)});
+    }
+    return points;
+  }
+
+  std::vector<Candidate> candidates_of_len(int len)
+  {
+    auto composer = Composer(seed);
+    auto ret = std::vector<Candidate>(num_samples);
+    for (auto& candidate : ret) {
+      composer.gen_random_code(len, candidate);
+    }
+    return ret;
+  }
+
+  // Expression lengths, as passed to Composer::gen_random_code
+  void lengths(benchmark::internal::Benchmark* b)
+  {
+    for (int len : {2, 4, 8, 12, 16, 20}) {
+      b->Arg(len);
+    }
+  }
+
+
+  void BM_gen_random_expr(benchmark::State& state)
+  {
+    auto composer = Composer(seed);
+    auto len = static_cast<int>(state.range(0));
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(composer.gen_random_expr(len));
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_gen_random_expr)->Apply(lengths);
+
+  void BM_gen_random_code(benchmark::State& state)
+  {
+    auto composer = Composer(seed);
+    auto len = static_cast<int>(state.range(0));
+    auto candidate = Candidate{};
+    for (auto _ : state) {
+      composer.gen_random_code(len, candidate);
+      benchmark::DoNotOptimize(candidate.code.data());
+      benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_gen_random_code)->Apply(lengths);
+
+  void BM_compile(benchmark::State& state)
+  {
+    auto composer = Composer(seed);
+    auto exprs = std::vector<std::string>{};
+    for (const auto& candidate : candidates_of_len(state.range(0))) {
+      exprs.push_back(candidate.to_string());
+    }
+    std::size_t i = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(composer.compile(exprs[i++ % num_samples]));
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_compile)->Apply(lengths);
+
+  void BM_Composer_eval(benchmark::State& state)
+  {
+    auto composer = Composer(seed);
+    auto compiled = std::vector<std::vector<MemberFuncPtr>>{};
+    for (const auto& candidate : candidates_of_len(state.range(0))) {
+      compiled.push_back(composer.compile(candidate.to_string()));
+    }
+    std::size_t i = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(composer.eval(compiled[i++ % num_samples], 0.5));
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_Composer_eval)->Apply(lengths);
+
+  void BM_Evaluator_eval(benchmark::State& state)
+  {
+    auto candidates = candidates_of_len(state.range(0));
+    std::size_t i = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(
+        Evaluator::eval(candidates[i++ % num_samples].bytecode(), 0.5));
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_Evaluator_eval)->Apply(lengths);
+
+  void BM_eval_dual_checked(benchmark::State& state)
+  {
+    auto candidates = candidates_of_len(state.range(0));
+    std::size_t i = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(Evaluator::eval_dual_checked(
+        candidates[i++ % num_samples].bytecode(), 0.5));
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_eval_dual_checked)->Apply(lengths);
+
+  // The second argument picks the backend of the verifier.
+  void BM_is_correct_integral(benchmark::State& state)
+  {
+    auto candidates = candidates_of_len(state.range(0));
+    auto points = integrand_points();
+    auto verifier = Verifier(points, Differentiation::automatic,
+                             PointOrder::adaptive,
+                             static_cast<Backend>(state.range(1)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(verifier.is_correct_integral(
+        candidates[i++ % num_samples].bytecode()));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(state.range(1) == static_cast<int>(Backend::jit)
+                   ? "jit" : "interpreter");
+  }
+  BENCHMARK(BM_is_correct_integral)
+    ->ArgsProduct({{2, 4, 8, 12, 16, 20},
+                   {static_cast<int>(Backend::interpreter),
+                    static_cast<int>(Backend::jit)}});
+
+  void BM_infix_from_reverse_polish(benchmark::State& state)
+  {
+    auto exprs = std::vector<std::string>{};
+    for (const auto& candidate : candidates_of_len(state.range(0))) {
+      exprs.push_back(candidate.to_string());
+    }
+    std::size_t i = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(
+        infix_from_reverse_polish(exprs[i++ % num_samples]));
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_infix_from_reverse_polish)->Apply(lengths);
+
+  // The whole search, on an integrand it doesn't solve within the budget, so
+  // that every run makes the same number of attempts.
+  void BM_search(benchmark::State& state)
+  {
+    auto points = std::vector<Point>{};
+    for (double x : {0.2, 0.5, 0.9, 1.5, 2.0}) {
+      points.push_back({x, std::exp(std::sin(x) * x) * 3.7});
+    }
+    auto num_threads = static_cast<unsigned int>(state.range(0));
+    auto engine = SearchEngine(num_threads, seed);
+    unsigned long num_attempts = 0;
+    for (auto _ : state) {
+      auto job = SearchJob{points, 2'000'000};
+      num_attempts += engine.submit(std::move(job)).result().get().num_attempts;
+    }
+    state.SetItemsProcessed(num_attempts);
+  }
+  BENCHMARK(BM_search)
+    ->RangeMultiplier(2)->Range(1, 16)
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+} // namespace
+
+
+BENCHMARK_MAIN();
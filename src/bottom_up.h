@@ -0,0 +1,200 @@
+#pragma once
+
+#include "integrator.h"
+#include <vector>
+#include <span>
+#include <string>
+#include <unordered_set>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+
+
+namespace integrator {
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Builds expressions by increasing size, out of the smaller ones already
+  // built, and hands each of them over to be tested against the integrands.
+  //
+  // An expression is only kept if its fingerprint, i.e. its values and
+  // derivatives at the sample points, differs from that of every expression
+  // kept before. Anything built on top of it would behave at the points, the
+  // only place the integrands are known, exactly as on top of the earlier one:
+  // `x1+` is dropped for `x>`, and so are `1x+`, `x~~>`, ... Expressions with
+  // non-finite fingerprints are dropped too, as the verifier rejects anything
+  // they are part of.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class BottomUpSearch {
+  public:
+    // Past this many expressions kept, the new ones are still tested, but no
+    // longer kept to build larger ones.
+    static constexpr std::size_t default_max_kept = std::size_t{1} << 20;
+
+    explicit BottomUpSearch(std::span<const double> xs,
+                            std::size_t max_kept = default_max_kept)
+      : max_kept{max_kept},
+      xs(xs.begin(), xs.end()),
+      scratch(xs.size())
+    {
+      assert(!xs.empty());
+    }
+
+    // Size of the expressions that the next call to grow builds
+    std::size_t next_size() const { return levels.size(); }
+
+    // Builds the expressions of the next size, and calls `test` with the
+    // fingerprint of each new one, along with a function returning it in RPN.
+    // Stops as soon as `keep_going`, which is called before building each
+    // expression, returns false. Returns true if the whole size was covered,
+    // up to equivalence.
+    template<typename K, typename T>
+    bool grow(K&& keep_going, T&& test)
+    {
+      auto size = next_size();
+      levels.push_back(nodes.size());
+      auto complete = !dropped;
+
+      auto build = [&](Opcode op, uint32_t lhs, uint32_t rhs) {
+        if (!keep_going()) {
+          complete = false;
+          return false;
+        }
+        add(op, lhs, rhs, test);
+        return true;
+      };
+
+      if (size == 1) {
+        for (auto op : nullary_opcodes) {
+          for (std::size_t i = 0; i < xs.size(); ++i) {
+            scratch[i] = leaf(op, xs[i]);
+          }
+          if (!build(op, 0, 0)) {
+            return false;
+          }
+        }
+        return complete;
+      }
+
+      auto [begin, end] = level(size - 1);
+      for (auto op : unary_opcodes) {
+        for (auto i = begin; i < end; ++i) {
+          kernels::with_unary(op, [&](const auto& kernel) {
+            for (std::size_t k = 0; k < xs.size(); ++k) {
+              scratch[k] = duals[i * xs.size() + k];
+              kernel(scratch[k]);
+            }
+          });
+          if (!build(op, i, 0)) {
+            return false;
+          }
+        }
+      }
+
+      for (std::size_t lhs_size = 1; lhs_size + 1 < size; ++lhs_size) {
+        auto [lhs_begin, lhs_end] = level(lhs_size);
+        auto [rhs_begin, rhs_end] = level(size - 1 - lhs_size);
+        for (auto op : binary_opcodes) {
+          for (auto i = lhs_begin; i < lhs_end; ++i) {
+            for (auto j = rhs_begin; j < rhs_end; ++j) {
+              kernels::with_binary(op, [&](const auto& kernel) {
+                for (std::size_t k = 0; k < xs.size(); ++k) {
+                  scratch[k] = duals[i * xs.size() + k];
+                  kernel(scratch[k], duals[j * xs.size() + k]);
+                }
+              });
+              if (!build(op, i, j)) {
+                return false;
+              }
+            }
+          }
+        }
+      }
+
+      return complete;
+    }
+
+    std::size_t num_kept() const { return nodes.size(); }
+
+  private:
+    // An expression kept, whose operands are expressions kept before it
+    struct Node {
+      Opcode op;
+      uint32_t lhs; // Or the sole operand of a unary operator
+      uint32_t rhs;
+    };
+
+    std::size_t max_kept;
+    std::vector<double> xs;
+    std::vector<Node> nodes;   // By increasing size
+    std::vector<Dual> duals;   // Fingerprints of the nodes, xs.size() each
+    std::vector<Dual> scratch; // Fingerprint of the expression being built
+    std::vector<std::size_t> levels{0}; // Index of the first node per size
+    std::unordered_set<uint64_t> seen;  // Hashes of the fingerprints kept
+    bool dropped = false; // Whether some expression was tested but not kept
+
+    // The nodes of the given size, as a range of indices
+    std::pair<uint32_t, uint32_t> level(std::size_t size) const
+    {
+      auto end = size + 1 < levels.size() ? levels[size + 1] : nodes.size();
+      return {static_cast<uint32_t>(levels[size]),
+              static_cast<uint32_t>(end)};
+    }
+
+    static Dual leaf(Opcode op, double x)
+    {
+      switch (op) {
+        case Opcode::x: return {x, 1.0};
+        case Opcode::zero: return {0.0};
+        case Opcode::one: return {1.0};
+        default: break;
+      }
+      assert(false);
+      return {};
+    }
+
+    // Tests the expression in scratch if it is new, and keeps it if there
+    // is room left.
+    template<typename T>
+    void add(Opcode op, uint32_t lhs, uint32_t rhs, T& test)
+    {
+      auto hash = uint64_t{0};
+      for (const auto& dual : scratch) {
+        if (!std::isfinite(dual.value) || !std::isfinite(dual.deriv)) {
+          return;
+        }
+        hash = mix64(hash ^ std::bit_cast<uint64_t>(dual.value));
+        hash = mix64(hash ^ std::bit_cast<uint64_t>(dual.deriv));
+      }
+
+      auto is_kept = nodes.size() < max_kept;
+      if (is_kept ? !seen.insert(hash).second : seen.contains(hash)) {
+        return;
+      }
+      test(std::span<const Dual>(scratch), [&] {
+        return to_string(Node{op, lhs, rhs});
+      });
+      if (!is_kept) {
+        dropped = true;
+        return;
+      }
+
+      nodes.push_back({op, lhs, rhs});
+      duals.insert(duals.end(), scratch.begin(), scratch.end());
+    }
+
+    std::string to_string(const Node& node) const
+    {
+      switch (arity(node.op)) {
+        case 1:
+          return to_string(nodes[node.lhs]) + symbol_of(node.op);
+        case 2:
+          return to_string(nodes[node.lhs]) + to_string(nodes[node.rhs])
+            + symbol_of(node.op);
+      }
+      return std::string(1, symbol_of(node.op));
+    }
+  };
+
+} // namespace integrator
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "integrator.h"
+#include <array>
+#include <algorithm>
+#include <limits>
+#include <cstddef>
+
+
+namespace integrator {
+
+  //////////////////////////////////////////////////////////////////////////////
+  // The programs of lowest loss that a worker has come across, for it to
+  // mutate in the hope of getting closer. Each one is kept along with the
+  // integrand it is closest to. The pool belongs to a single worker, and its
+  // capacity is small enough for a linear scan to beat any index.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class CandidatePool {
+  public:
+    static constexpr std::size_t capacity = 32;
+
+    struct Entry {
+      Candidate candidate;
+      double loss;
+      std::size_t integrand;
+    };
+
+    bool empty() const { return size == 0; }
+
+    // Largest loss of a candidate that offer() would take in
+    double worst_loss() const
+    {
+      return size < capacity
+        ? std::numeric_limits<double>::infinity()
+        : entries[worst].loss;
+    }
+
+    // Takes the candidate in, in place of the worst one if the pool is full,
+    // unless it is no better or already in. Returns whether it did.
+    bool offer(const Candidate& candidate, double loss, std::size_t integrand)
+    {
+      if (!(loss < worst_loss())) {
+        return false;
+      }
+      auto is_in = std::any_of(
+          entries.begin(), entries.begin() + size, [&](const Entry& entry) {
+            return entry.candidate.size == candidate.size
+              && std::equal(candidate.code.begin(),
+                            candidate.code.begin() + candidate.size,
+                            entry.candidate.code.begin());
+          });
+      if (is_in) {
+        return false;
+      }
+
+      entries[size < capacity ? size++ : worst] = {candidate, loss, integrand};
+      update_worst();
+      return true;
+    }
+
+    void clear()
+    {
+      size = 0;
+      worst = 0;
+    }
+
+    // The better of two entries drawn at random, which favours the best ones
+    // without starving the others. The pool must not be empty.
+    template<typename G>
+    const Entry& draw(G& rng) const
+    {
+      const auto& a = entries[draw_below(rng, size)];
+      const auto& b = entries[draw_below(rng, size)];
+      return a.loss <= b.loss ? a : b;
+    }
+
+    // Drops the entries for which pred is true, e.g. those of the integrands
+    // already resolved.
+    template<typename P>
+    void remove_if(P pred)
+    {
+      auto end = std::remove_if(entries.begin(), entries.begin() + size, pred);
+      size = end - entries.begin();
+      update_worst();
+    }
+
+  private:
+    std::array<Entry, capacity> entries;
+    std::size_t size = 0;
+    std::size_t worst = 0; // Index of the entry of largest loss
+
+    void update_worst()
+    {
+      worst = std::max_element(entries.begin(), entries.begin() + size,
+                               [](const Entry& a, const Entry& b) {
+                                 return a.loss < b.loss;
+                               }) - entries.begin();
+    }
+  };
+
+} // namespace integrator
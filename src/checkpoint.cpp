@@ -0,0 +1,160 @@
+///////////////////////////////////////////////////////////////////////////////
+/////////////////////////     checkpoint.cpp     //////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+//
+// The file is a header followed by one slot per worker, each on a cache line
+// of its own:
+//
+//   header:  magic, hash of the job, number of workers
+//   slot:    two copies of {generation, attempts, claim, generator state}
+//
+// A worker saves to the copy of the next generation, and publishes the
+// generation last, so that the copy of the highest one is always whole.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "checkpoint.h"
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <fmt/format.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace integrator {
+
+  namespace {
+    constexpr char magic[8] = {'I', 'N', 'T', 'G', 'C', 'K', 'P', '1'};
+  }
+
+  struct alignas(64) Checkpoint::Header {
+    char magic[8];
+    uint64_t job_hash;
+    uint32_t num_workers;
+  };
+
+  struct alignas(64) Checkpoint::Slot {
+    struct Copy {
+      uint64_t generation; // 0 if never saved
+      uint64_t num_attempts;
+      uint64_t claim;
+      uint32_t rng_state;
+    };
+    Copy copies[2];
+  };
+
+  Checkpoint::Checkpoint(const std::string& path, uint64_t job_hash,
+                         unsigned int num_workers)
+    : size{sizeof(Header) + num_workers * sizeof(Slot)}
+  {
+    static_assert(sizeof(Header) == 64 && sizeof(Slot) == 64);
+
+    auto fail = [&path](const char* what) {
+      auto error = errno;
+      throw std::system_error(error, std::generic_category(),
+                              fmt::format("{} {}", what, path));
+    };
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+      fail("open");
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+      ::close(fd);
+      fail("fstat");
+    }
+    auto file_size = static_cast<std::size_t>(info.st_size);
+    if (file_size != 0 && file_size != size) {
+      ::close(fd);
+      throw std::runtime_error(fmt::format(
+          "{} is not a checkpoint of {} workers", path, num_workers));
+    }
+    if (file_size == 0 && ::ftruncate(fd, size) != 0) {
+      ::close(fd);
+      fail("ftruncate");
+    }
+
+    data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      ::close(fd);
+      fail("mmap");
+    }
+
+    // A header of zeros is that of a file created, but never saved to.
+    auto& header = *static_cast<Header*>(data);
+    auto is_new = std::all_of(std::begin(header.magic), std::end(header.magic),
+                              [](char c) { return c == 0; });
+    if (is_new) {
+      header.job_hash = job_hash;
+      header.num_workers = num_workers;
+      std::memcpy(header.magic, magic, sizeof(magic));
+      return;
+    }
+
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0
+        || header.job_hash != job_hash
+        || header.num_workers != num_workers) {
+      ::munmap(data, size);
+      ::close(fd);
+      throw std::runtime_error(fmt::format(
+          "{} holds no checkpoint of this job by {} workers", path,
+          num_workers));
+    }
+
+    for (auto id = 0u; id < num_workers; ++id) {
+      const auto& copies = slot(id).copies;
+      const auto& latest = copies[0].generation > copies[1].generation
+        ? copies[0]
+        : copies[1];
+      auto state = WorkerState{};
+      if (latest.generation != 0) {
+        state = {latest.rng_state, latest.num_attempts, latest.claim};
+      }
+      resumed_states.push_back(state);
+    }
+  }
+
+
+  Checkpoint::~Checkpoint()
+  {
+    ::munmap(data, size);
+    ::close(fd);
+  }
+
+
+  Checkpoint::Slot& Checkpoint::slot(unsigned int id) const
+  {
+    auto slots = reinterpret_cast<Slot*>(static_cast<char*>(data)
+                                         + sizeof(Header));
+    return slots[id];
+  }
+
+
+  void Checkpoint::save(unsigned int id, const WorkerState& state)
+  {
+    auto& copies = slot(id).copies;
+    auto generation = std::max(copies[0].generation,
+                               copies[1].generation) + 1;
+    auto& copy = copies[generation % 2];
+    copy.num_attempts = state.num_attempts;
+    copy.claim = state.claim;
+    copy.rng_state = state.rng_state;
+    std::atomic_ref(copy.generation).store(generation,
+                                           std::memory_order_release);
+  }
+
+
+  void Checkpoint::flush()
+  {
+    ::msync(data, size, MS_SYNC);
+  }
+
+} // namespace integrator
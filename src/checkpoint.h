@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace integrator {
+
+  //////////////////////////////////////////////////////////////////////////////
+  // The state of the workers of a job, in a small file mapped into memory, so
+  // that a job cut short, e.g. by the preemption of its machine, can carry on
+  // where it stopped. Each worker saves its own slot with plain stores to the
+  // mapping, which costs no system call, and the kernel writes the pages back
+  // on its own, or when flush() asks it to. A slot holds two copies, saved in
+  // turn, so that a process killed halfway through saving still leaves the
+  // other copy whole.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class Checkpoint {
+  public:
+    struct WorkerState {
+      uint32_t rng_state = 0; // 0 if the worker never saved
+      uint64_t num_attempts = 0;
+      uint64_t claim = 0; // Last chunk of enumerated programs claimed
+    };
+
+    // Maps the file at `path`, creating it if needed. If it holds a checkpoint
+    // of the same job, the states saved in it are resumed. Throws
+    // std::system_error if the file can't be mapped, and std::runtime_error if
+    // it holds anything else than a checkpoint of this job by as many workers.
+    Checkpoint(const std::string& path, uint64_t job_hash,
+               unsigned int num_workers);
+
+    ~Checkpoint();
+
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    // The states of the workers when the file was last saved to, one per
+    // worker, and empty if it held no checkpoint.
+    const std::vector<WorkerState>& resumed() const { return resumed_states; }
+
+    // Called by worker `id` only.
+    void save(unsigned int id, const WorkerState& state);
+
+    // Waits for the saved states to be written back to the file.
+    void flush();
+
+  private:
+    struct Header;
+    struct Slot;
+
+    int fd = -1;
+    void* data = nullptr;
+    std::size_t size = 0;
+    std::vector<WorkerState> resumed_states;
+
+    Slot& slot(unsigned int id) const;
+  };
+
+} // namespace integrator
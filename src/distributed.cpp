@@ -0,0 +1,332 @@
+///////////////////////////////////////////////////////////////////////////////
+/////////////////////////    distributed.cpp     //////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+//
+// The protocol, one message per line:
+//
+//   coordinator -> node:  job <seed> <partition> <num_partitions>
+//                             <max_attempts> <num_points>
+//                         point <x> <y>             (num_points times)
+//                         cancel
+//   node -> coordinator:  attempts <n>              (a few times a second)
+//                         found <rpn>
+//                         done <n>                  (last message)
+//
+// Numbers are written in their shortest form that reads back exactly.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "distributed.h"
+#include <optional>
+#include <sstream>
+#include <system_error>
+#include <utility>
+#include <chrono>
+#include <cassert>
+#include <cerrno>
+#include <fmt/format.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+namespace integrator {
+
+  namespace {
+
+    [[noreturn]] void fail(const char* what)
+    {
+      throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    // A socket, and what was received on it but not read yet
+    class Connection {
+    public:
+      explicit Connection(int fd) : fd{fd} { }
+      ~Connection() { if (fd != -1) ::close(fd); }
+
+      Connection(Connection&& o) noexcept
+        : fd{std::exchange(o.fd, -1)}, received{std::move(o.received)}
+      { }
+      Connection& operator=(Connection&&) = delete;
+
+      int handle() const { return fd; }
+
+      // Returns false if the peer is gone.
+      bool send(const std::string& line)
+      {
+        auto message = line + '\n';
+        for (std::size_t sent = 0; sent < message.size(); ) {
+          auto n = ::send(fd, message.data() + sent, message.size() - sent,
+                          MSG_NOSIGNAL);
+          if (n <= 0) {
+            return false;
+          }
+          sent += n;
+        }
+        return true;
+      }
+
+      // Reads what has arrived, blocking until something has. Returns false
+      // once the peer is gone.
+      bool receive()
+      {
+        char buffer[4096];
+        auto n = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+          return false;
+        }
+        received.append(buffer, n);
+        return true;
+      }
+
+      // The next complete line received, without its newline
+      std::optional<std::string> next_line()
+      {
+        auto end = received.find('\n');
+        if (end == std::string::npos) {
+          return std::nullopt;
+        }
+        auto line = received.substr(0, end);
+        received.erase(0, end + 1);
+        return line;
+      }
+
+      // Blocks until a whole line has arrived.
+      std::optional<std::string> read_line()
+      {
+        while (true) {
+          if (auto line = next_line()) {
+            return line;
+          }
+          if (!receive()) {
+            return std::nullopt;
+          }
+        }
+      }
+
+    private:
+      int fd;
+      std::string received;
+    };
+
+    // Whether data arrived on fd within the timeout
+    bool wait_readable(int fd, std::chrono::milliseconds timeout)
+    {
+      pollfd p{fd, POLLIN, 0};
+      return ::poll(&p, 1, static_cast<int>(timeout.count())) > 0;
+    }
+
+    Connection listen_on(uint16_t port)
+    {
+      int fd = ::socket(AF_INET6, SOCK_STREAM, 0);
+      if (fd == -1) {
+        fail("socket");
+      }
+      auto listener = Connection(fd);
+
+      int yes = 1;
+      ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+      int no = 0;
+      ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+
+      sockaddr_in6 address{};
+      address.sin6_family = AF_INET6;
+      address.sin6_addr = in6addr_any;
+      address.sin6_port = htons(port);
+      if (::bind(fd, reinterpret_cast<const sockaddr*>(&address),
+                 sizeof(address)) != 0) {
+        fail("bind");
+      }
+      if (::listen(fd, SOMAXCONN) != 0) {
+        fail("listen");
+      }
+      return listener;
+    }
+
+    Connection connect_to(const std::string& host, uint16_t port)
+    {
+      addrinfo hints{};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      addrinfo* addresses = nullptr;
+      auto service = std::to_string(port);
+      if (::getaddrinfo(host.c_str(), service.c_str(), &hints,
+                        &addresses) != 0) {
+        errno = EHOSTUNREACH;
+        fail("getaddrinfo");
+      }
+
+      int fd = -1;
+      for (auto a = addresses; a; a = a->ai_next) {
+        fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd == -1) {
+          continue;
+        }
+        if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+          break;
+        }
+        ::close(fd);
+        fd = -1;
+      }
+      ::freeaddrinfo(addresses);
+      if (fd == -1) {
+        fail("connect");
+      }
+      return Connection(fd);
+    }
+
+  } // namespace
+
+
+  std::pair<std::string, unsigned long>
+  coordinate_search(const std::vector<Point>& integrand_points,
+                    unsigned int seed,
+                    unsigned int num_nodes,
+                    unsigned long max_attempts,
+                    uint16_t port)
+  {
+    assert(num_nodes > 0);
+
+    auto listener = listen_on(port);
+    auto nodes = std::vector<Connection>{};
+    while (nodes.size() < num_nodes) {
+      int fd = ::accept(listener.handle(), nullptr, nullptr);
+      if (fd == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        fail("accept");
+      }
+      nodes.emplace_back(fd);
+    }
+
+    // The budget is split evenly, rounding up.
+    auto node_attempts = (max_attempts + num_nodes - 1) / num_nodes;
+    for (auto i = 0u; i < num_nodes; ++i) {
+      nodes[i].send(fmt::format("job {} {} {} {} {}", seed + i, i, num_nodes,
+                                node_attempts, integrand_points.size()));
+      for (const auto& [x, y] : integrand_points) {
+        nodes[i].send(fmt::format("point {} {}", x, y));
+      }
+    }
+
+    auto result = std::string{};
+    auto attempts = std::vector<unsigned long>(num_nodes);
+    auto is_open = std::vector<bool>(num_nodes, true);
+    auto num_open = num_nodes;
+
+    auto cancel_all = [&] {
+      for (auto i = 0u; i < num_nodes; ++i) {
+        if (is_open[i]) {
+          nodes[i].send("cancel");
+        }
+      }
+    };
+
+    while (num_open > 0) {
+      auto fds = std::vector<pollfd>{};
+      for (auto i = 0u; i < num_nodes; ++i) {
+        fds.push_back({is_open[i] ? nodes[i].handle() : -1, POLLIN, 0});
+      }
+      if (::poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        fail("poll");
+      }
+
+      for (auto i = 0u; i < num_nodes; ++i) {
+        if (!is_open[i] || !(fds[i].revents & (POLLIN | POLLHUP))) {
+          continue;
+        }
+
+        auto is_gone = !nodes[i].receive();
+        while (auto line = nodes[i].next_line()) {
+          auto in = std::istringstream(*line);
+          auto word = std::string{};
+          in >> word;
+          if (word == "attempts" || word == "done") {
+            in >> attempts[i];
+            is_gone |= word == "done";
+          } else if (word == "found" && result.empty()) {
+            in >> result;
+            cancel_all();
+          }
+        }
+        if (is_gone) {
+          is_open[i] = false;
+          --num_open;
+        }
+      }
+    }
+
+    auto total = 0ul;
+    for (auto n : attempts) {
+      total += n;
+    }
+    return {result, total};
+  }
+
+
+  void serve_search(const std::string& coordinator_host,
+                    uint16_t port,
+                    unsigned int num_threads)
+  {
+    auto coordinator = connect_to(coordinator_host, port);
+
+    auto job = SearchJob{};
+    auto seed = 0u;
+    auto num_points = std::size_t{0};
+    if (auto line = coordinator.read_line()) {
+      auto in = std::istringstream(*line);
+      auto word = std::string{};
+      in >> word >> seed >> job.partition >> job.num_partitions
+         >> job.max_attempts >> num_points;
+    }
+    for (std::size_t i = 0; i < num_points; ++i) {
+      auto line = coordinator.read_line();
+      if (!line) {
+        return;
+      }
+      auto in = std::istringstream(*line);
+      auto word = std::string{};
+      auto point = Point{};
+      in >> word >> point.first >> point.second;
+      job.integrand_points.push_back(point);
+    }
+    if (job.integrand_points.empty()) {
+      return; // Not a coordinator, or it went away
+    }
+
+    auto engine = SearchEngine(num_threads, seed);
+    auto handle = engine.submit(std::move(job));
+
+    using namespace std::chrono_literals;
+    auto& future = handle.result();
+    while (future.wait_for(0s) != std::future_status::ready) {
+      if (wait_readable(coordinator.handle(), 200ms)) {
+        // Either a cancellation, or the coordinator went away.
+        if (!coordinator.receive()) {
+          handle.cancel();
+        }
+        while (auto line = coordinator.next_line()) {
+          if (*line == "cancel") {
+            handle.cancel();
+          }
+        }
+      }
+      coordinator.send(fmt::format("attempts {}", handle.num_attempts()));
+    }
+
+    auto result = future.get();
+    if (!result.expr.empty()) {
+      coordinator.send("found " + result.expr);
+    }
+    coordinator.send(fmt::format("done {}", result.num_attempts));
+  }
+
+} // namespace integrator
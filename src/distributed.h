@@ -0,0 +1,39 @@
+#pragma once
+
+#include "search.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+
+namespace integrator {
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Spreads a search over several machines, through a plain TCP protocol of
+  // text lines. The coordinator waits for `num_nodes` nodes to connect, and
+  // hands each of them the integrand, its own seed, its own partition of the
+  // enumerated programs, and its share of the attempts. The nodes report their
+  // attempts as they go, and the first one to find an antiderivative has the
+  // coordinator cancel all the others.
+  //
+  // Failures to listen or to connect throw std::system_error.
+  //////////////////////////////////////////////////////////////////////////////
+
+  // Same as search(), with the nodes doing the work. Returns the first
+  // antiderivative found, and the attempts of all the nodes.
+  std::pair<std::string, unsigned long>
+  coordinate_search(const std::vector<Point>& integrand_points,
+                    unsigned int seed,
+                    unsigned int num_nodes,
+                    unsigned long max_attempts,
+                    uint16_t port);
+
+  // Connects to a coordinator, and searches with a local engine of
+  // `num_threads` workers (0 for one per physical core) until the job is
+  // over.
+  void serve_search(const std::string& coordinator_host,
+                    uint16_t port,
+                    unsigned int num_threads);
+
+} // namespace integrator
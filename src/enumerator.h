@@ -0,0 +1,183 @@
+#pragma once
+
+#include "integrator.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+
+
+namespace integrator {
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Walks every stack-valid program over the opcode pools, by increasing size
+  // and then in lexicographic order, up to a maximum size. Each program has an
+  // index in that order, so that the space splits into ranges of indices that
+  // workers can claim: seek to the start of a range, then step through it.
+  //
+  // Completions are counted once and for all at compile time, which makes
+  // seeking O(size), and stepping amortized O(1). Stepping mostly changes the
+  // last few opcodes, and tells how many came before, for PrefixEvaluator to
+  // resume from there.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class Enumerator {
+  public:
+    // Beyond which the number of programs overflows, and is hopeless anyway.
+    static constexpr std::size_t max_max_size = 15;
+
+    explicit Enumerator(std::size_t max_size)
+      : max_size{max_size}
+    {
+      assert(max_size <= max_max_size);
+    }
+
+    // Number of programs of all sizes from 1 to max_size
+    uint64_t count() const
+    {
+      auto ret = uint64_t{0};
+      for (std::size_t size = 1; size <= max_size; ++size) {
+        ret += completions[size][0];
+      }
+      return ret;
+    }
+
+    // Makes `candidate` the program at `index`, which must be below count().
+    void seek(uint64_t index, Candidate& candidate)
+    {
+      std::size_t size = 1;
+      while (index >= completions[size][0]) {
+        index -= completions[size][0];
+        ++size;
+      }
+      assert(size <= max_size);
+
+      depths[0] = 0;
+      for (std::size_t pos = 0; pos < size; ++pos) {
+        auto remaining = size - pos - 1;
+        auto depth = depths[pos];
+
+        // The opcodes of one arity all have the same number of completions.
+        unsigned int first = 0;
+        for (auto n : num_of_arity) {
+          auto a = static_cast<unsigned int>(arity(alphabet[first]));
+          auto next_depth = depth + 1 - a;
+          auto block = depth >= a ? completions[remaining][next_depth] : 0;
+          if (index < n * block) {
+            choices[pos] = first + index / block;
+            depths[pos+1] = next_depth;
+            index %= block;
+            break;
+          }
+          index -= n * block;
+          first += n;
+        }
+      }
+
+      write(size, 0, candidate);
+    }
+
+    // Moves `candidate`, which must come from seek or next, to the following
+    // program. Returns false past the last one.
+    bool next(Candidate& candidate)
+    {
+      auto size = candidate.size;
+      for (auto pos = size; pos-- > 0; ) {
+        for (auto k = choices[pos] + 1u; k < alphabet.size(); ++k) {
+          if (fits(size, pos, k)) {
+            choices[pos] = k;
+            depths[pos+1] = depths[pos] + 1 - arity(alphabet[k]);
+            fill_first(size, pos + 1);
+            write(size, pos, candidate);
+            return true;
+          }
+        }
+      }
+
+      if (++size > max_size) {
+        return false;
+      }
+      depths[0] = 0;
+      fill_first(size, 0);
+      write(size, 0, candidate);
+      return true;
+    }
+
+    // Number of leading opcodes that the last seek or next left unchanged
+    std::size_t num_unchanged() const { return unchanged; }
+
+  private:
+    static constexpr auto alphabet = [] {
+      std::array<Opcode, nullary_opcodes.size() + unary_opcodes.size()
+                 + binary_opcodes.size()> ret{};
+      std::size_t i = 0;
+      for (auto op : nullary_opcodes) { ret[i++] = op; }
+      for (auto op : unary_opcodes) { ret[i++] = op; }
+      for (auto op : binary_opcodes) { ret[i++] = op; }
+      return ret;
+    }();
+
+    static constexpr std::array<unsigned int, 3> num_of_arity = {
+      nullary_opcodes.size(), unary_opcodes.size(), binary_opcodes.size()};
+
+    // completions[r][d] is the number of ways for r more opcodes to take a
+    // stack of depth d down to a single value.
+    static constexpr auto completions = [] {
+      std::array<std::array<uint64_t, max_max_size + 2>,
+                 max_max_size + 1> ret{};
+      ret[0][1] = 1;
+      for (std::size_t r = 1; r <= max_max_size; ++r) {
+        for (std::size_t d = 0; d + r <= max_max_size + 1; ++d) {
+          ret[r][d] = num_of_arity[0] * ret[r-1][d+1];
+          if (d >= 1) {
+            ret[r][d] += num_of_arity[1] * ret[r-1][d];
+          }
+          if (d >= 2) {
+            ret[r][d] += num_of_arity[2] * ret[r-1][d-1];
+          }
+        }
+      }
+      return ret;
+    }();
+
+    std::size_t max_size;
+    std::array<unsigned int, max_max_size> choices; // Indices into alphabet
+    std::array<unsigned int, max_max_size + 1> depths; // Before each opcode
+    std::size_t unchanged = 0;
+
+    // Whether alphabet[k] at `pos` still leaves a way to complete the program
+    bool fits(std::size_t size, std::size_t pos, unsigned int k) const
+    {
+      auto a = static_cast<unsigned int>(arity(alphabet[k]));
+      if (depths[pos] < a) {
+        return false;
+      }
+      return completions[size - pos - 1][depths[pos] + 1 - a] > 0;
+    }
+
+    // Completes the program from `pos` on with its first valid suffix.
+    void fill_first(std::size_t size, std::size_t pos)
+    {
+      for (; pos < size; ++pos) {
+        auto k = 0u;
+        while (!fits(size, pos, k)) {
+          ++k;
+        }
+        choices[pos] = k;
+        depths[pos+1] = depths[pos] + 1 - arity(alphabet[k]);
+      }
+    }
+
+    // Copies the opcodes from `from` on, the ones before being unchanged.
+    void write(std::size_t size, std::size_t from, Candidate& candidate)
+    {
+      unchanged = from;
+      for (auto pos = from; pos < size; ++pos) {
+        candidate.code[pos] = alphabet[choices[pos]];
+      }
+      candidate.code[size] = Opcode::end;
+      candidate.size = size;
+    }
+  };
+
+} // namespace integrator
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "integrator.h"
+#include <array>
+#include <span>
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cassert>
+
+
+namespace integrator {
+
+  // A string literal as a template argument, e.g. FixedExpression<"xxS>L*">.
+  template<std::size_t N>
+  struct FixedString {
+    char chars[N] = {};
+
+    constexpr FixedString(const char (&s)[N])
+    {
+      for (std::size_t i = 0; i < N; ++i) {
+        chars[i] = s[i];
+      }
+    }
+
+    static constexpr std::size_t size() { return N - 1; }
+  };
+
+
+  //////////////////////////////////////////////////////////////////////////////
+  // An expression in RPN known at compile time, such as an antiderivative
+  // found earlier, turned into a plain function of x. The program is parsed
+  // and checked at compile time, and every opcode becomes its own template
+  // instantiation calling the kernel directly, so that nothing is left to
+  // dispatch at run time: the compiler sees one straight expression, which it
+  // inlines, and vectorizes in eval_batch as far as the operators allow.
+  //
+  // Like Evaluator, it runs on doubles as well as on dual numbers.
+  //////////////////////////////////////////////////////////////////////////////
+
+  template<FixedString Rpn>
+  class FixedExpression {
+  public:
+    static constexpr std::size_t size = Rpn.size();
+
+    static constexpr auto code = [] {
+      std::array<Opcode, size> ret{};
+      for (std::size_t i = 0; i < size; ++i) {
+        ret[i] = opcode_of(Rpn.chars[i]);
+      }
+      return ret;
+    }();
+
+    static_assert(size > 0, "Empty expression");
+    static_assert([] {
+      int depth = 0;
+      for (auto op : code) {
+        depth += 1 - arity(op);
+        if (depth < 1) {
+          return false;
+        }
+      }
+      return depth == 1;
+    }(), "Malformed expression: every operator needs its operands, and a "
+         "single value must be left");
+
+    template<typename T>
+    static T eval(const T& x)
+    {
+      return eval_at<size - 1>(x);
+    }
+
+    // The value and exact derivative at x
+    static Dual eval_dual(double x)
+    {
+      return eval(Dual{x, 1.0});
+    }
+
+    static void eval_batch(std::span<const double> xs, std::span<double> ys)
+    {
+      assert(xs.size() == ys.size());
+      for (std::size_t i = 0; i < xs.size(); ++i) {
+        ys[i] = eval(xs[i]);
+      }
+    }
+
+  private:
+    // Position of the first opcode of the subexpression ending at `end`
+    static constexpr std::size_t start_of(std::size_t end)
+    {
+      int needed = 1;
+      auto pos = end + 1;
+      while (needed > 0) {
+        --pos;
+        needed += arity(code[pos]) - 1;
+      }
+      return pos;
+    }
+
+    // Value of the subexpression ending at `pos`
+    template<std::size_t pos, typename T>
+    static T eval_at(const T& x)
+    {
+      constexpr auto op = code[pos];
+
+      if constexpr (op == Opcode::x) {
+        return x;
+      } else if constexpr (op == Opcode::zero) {
+        return T(0.0);
+      } else if constexpr (op == Opcode::one) {
+        return T(1.0);
+      } else if constexpr (arity(op) == 1) {
+        auto v = eval_at<pos - 1>(x);
+        kernel_of<op>()(v);
+        return v;
+      } else {
+        auto lhs = eval_at<start_of(pos - 1) - 1>(x);
+        auto rhs = eval_at<pos - 1>(x);
+        kernel_of<op>()(lhs, rhs);
+        return lhs;
+      }
+    }
+
+    // The kernel of an operator, picked at compile time
+    template<Opcode op>
+    static constexpr auto kernel_of()
+    {
+      if constexpr (op == Opcode::invert) { return kernels::invert; }
+      else if constexpr (op == Opcode::invert_sign) {
+        return kernels::invert_sign;
+      }
+      else if constexpr (op == Opcode::increment) { return kernels::increment; }
+      else if constexpr (op == Opcode::decrement) { return kernels::decrement; }
+      else if constexpr (op == Opcode::sin) { return kernels::sin; }
+      else if constexpr (op == Opcode::cos) { return kernels::cos; }
+      else if constexpr (op == Opcode::tan) { return kernels::tan; }
+      else if constexpr (op == Opcode::square) { return kernels::square; }
+      else if constexpr (op == Opcode::root) { return kernels::root; }
+      else if constexpr (op == Opcode::log) { return kernels::log; }
+      else if constexpr (op == Opcode::halve) { return kernels::halve; }
+      else if constexpr (op == Opcode::add) { return kernels::add; }
+      else if constexpr (op == Opcode::subtract) { return kernels::subtract; }
+      else if constexpr (op == Opcode::multiply) { return kernels::multiply; }
+      else { return kernels::divide; }
+    }
+  };
+
+
+  // Source of a header that names the FixedExpression of `rpn`, e.g. as
+  // returned by search(), for code downstream to include.
+  inline std::string fixed_expression_header(std::string_view name,
+                                             std::string_view rpn)
+  {
+    auto ret = std::string{};
+    ret += "#pragma once\n\n";
+    ret += "#include \"fixed_expression.h\"\n\n";
+    ret += "using ";
+    ret += name;
+    ret += " = integrator::FixedExpression<\"";
+    for (char c : rpn) {
+      if (c == '\\' || c == '"') {
+        ret += '\\';
+      }
+      ret += c;
+    }
+    ret += "\">;\n";
+    return ret;
+  }
+
+} // namespace integrator
@@ -0,0 +1,363 @@
+///////////////////////////////////////////////////////////////////////////////
+/////////////////////////         gpu.cu         //////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+//
+// Built with nvcc and -DINTEGRATOR_GPU=1, e.g.
+//
+//   nvcc -std=c++20 -O3 -DINTEGRATOR_GPU=1 -c gpu.cu
+//
+// and every other translation unit with -DINTEGRATOR_GPU=1 as well.
+//
+// A launch runs one thread per resident slot of the device, each composing
+// and screening candidates_per_thread candidates before saving its stream.
+// The host then picks up the hits, if any, and launches again. The device
+// code mirrors Composer::gen_random_code and the dual number kernels, as host
+// lambdas can't run on the device.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "gpu.h"
+#include "integrator.h"
+#include "verifier.h"
+#include <cuda_runtime.h>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+
+namespace integrator {
+
+  namespace {
+
+    // As in the CPU workers
+    constexpr int tentative_len = 20;
+    constexpr int max_size = 2 * (tentative_len + 1) - 1;
+
+    // Points screened on the device, the host checking any others
+    constexpr unsigned int max_device_points = 16;
+
+    // Candidates kept per launch. They are rare enough that the excess, which
+    // is dropped, is almost never more than false positives.
+    constexpr unsigned int max_hits = 64;
+
+    constexpr unsigned int num_nullary = nullary_opcodes.size();
+    constexpr unsigned int num_unary = unary_opcodes.size();
+    constexpr unsigned int num_binary = binary_opcodes.size();
+
+    constexpr unsigned int block_size = 128;
+    constexpr unsigned int candidates_per_thread = 256; // Per launch
+
+    __constant__ double device_xs[max_device_points];
+    __constant__ double device_ys[max_device_points];
+    __constant__ Opcode device_nullary[num_nullary];
+    __constant__ Opcode device_unary[num_unary];
+    __constant__ Opcode device_binary[num_binary];
+
+    struct Hits {
+      unsigned int count;
+      unsigned int sizes[max_hits];
+      Opcode codes[max_hits][max_size];
+    };
+
+
+    // Same as CustomGenerator
+    __device__ uint32_t draw(uint32_t& state)
+    {
+      uint32_t x = state;
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      return state = x;
+    }
+
+    // Same as draw_below
+    __device__ uint32_t draw_below_on_device(uint32_t& state, uint32_t n)
+    {
+      return static_cast<uint32_t>((uint64_t{draw(state)} * n) >> 32);
+    }
+
+    // Same as Composer::compose. Returns the size of the program.
+    __device__ int compose(uint32_t& state, Opcode* code)
+    {
+      int len = draw_below_on_device(state, tentative_len) + 2;
+      int size = 0;
+      int stack_size = 0;
+
+      for (int i = 0; i < len; ++i) {
+        int roof = stack_size >= 2 ? 3 : stack_size + 1;
+        int choice = draw_below_on_device(state, roof);
+        if (i == len - 1) {
+          choice = stack_size == 1 ? 1 : 2;
+        }
+
+        switch (choice) {
+          case 0:
+            code[size++] = device_nullary[
+              draw_below_on_device(state, num_nullary)];
+            stack_size++;
+            break;
+          case 1:
+            code[size++] = device_unary[
+              draw_below_on_device(state, num_unary)];
+            break;
+          case 2:
+            code[size++] = device_binary[
+              draw_below_on_device(state, num_binary)];
+            stack_size--;
+            break;
+        }
+      }
+
+      while (stack_size > 1) {
+        code[size++] = device_binary[
+          draw_below_on_device(state, num_binary)];
+        stack_size--;
+      }
+
+      return size;
+    }
+
+
+    struct DeviceDual {
+      double value;
+      double deriv;
+    };
+
+    // The derivative of the program at x, or NaN if any operator yields a
+    // non-finite value or derivative. As in the JIT, the check sums v - v over
+    // the results rather than branching. The formulas are those of Dual.
+    __device__ double derivative_at(const Opcode* code, int size, double x)
+    {
+      DeviceDual stack[max_size];
+      int sp = 0;
+      double poison = 0.0;
+
+      for (int i = 0; i < size; ++i) {
+        auto op = code[i];
+        if (op == Opcode::x) {
+          stack[sp++] = {x, 1.0};
+          continue;
+        }
+        if (op == Opcode::zero) {
+          stack[sp++] = {0.0, 0.0};
+          continue;
+        }
+        if (op == Opcode::one) {
+          stack[sp++] = {1.0, 0.0};
+          continue;
+        }
+
+        auto& a = op <= Opcode::halve ? stack[sp - 1] : stack[sp - 2];
+        const auto& b = stack[sp - 1];
+        switch (op) {
+          case Opcode::invert: {
+            double q = 1.0 / a.value;
+            a = {q, (0.0 - q * a.deriv) / a.value};
+            break;
+          }
+          case Opcode::invert_sign:
+            a = {a.value * -1.0, a.deriv * -1.0 + a.value * 0.0};
+            break;
+          case Opcode::increment: a.value += 1.0; break;
+          case Opcode::decrement: a.value -= 1.0; break;
+          case Opcode::sin:
+            a = {::sin(a.value), ::cos(a.value) * a.deriv};
+            break;
+          case Opcode::cos:
+            a = {::cos(a.value), -::sin(a.value) * a.deriv};
+            break;
+          case Opcode::tan: {
+            double t = ::tan(a.value);
+            a = {t, (1.0 + t * t) * a.deriv};
+            break;
+          }
+          case Opcode::square:
+            a = {a.value * a.value, a.deriv * a.value + a.value * a.deriv};
+            break;
+          case Opcode::root: {
+            double r = ::sqrt(a.value);
+            a = {r, a.deriv / (2.0 * r)};
+            break;
+          }
+          case Opcode::log:
+            a = {::log(a.value), a.deriv / a.value};
+            break;
+          case Opcode::halve: {
+            double q = a.value / 2.0;
+            a = {q, (a.deriv - q * 0.0) / 2.0};
+            break;
+          }
+          case Opcode::add:
+            a = {a.value + b.value, a.deriv + b.deriv};
+            break;
+          case Opcode::subtract:
+            a = {a.value - b.value, a.deriv - b.deriv};
+            break;
+          case Opcode::multiply:
+            a = {a.value * b.value, a.deriv * b.value + a.value * b.deriv};
+            break;
+          case Opcode::divide: {
+            double q = a.value / b.value;
+            a = {q, (a.deriv - q * b.deriv) / b.value};
+            break;
+          }
+          default:
+            break;
+        }
+        if (op > Opcode::halve) {
+          --sp;
+        }
+        poison += (a.value - a.value) + (a.deriv - a.deriv);
+      }
+
+      return stack[0].deriv + poison;
+    }
+
+
+    __global__ void screen(uint32_t* states, unsigned int num_points,
+                           double cutoff, Hits* hits)
+    {
+      auto t = blockIdx.x * blockDim.x + threadIdx.x;
+      auto state = states[t];
+      Opcode code[max_size];
+
+      for (unsigned int k = 0; k < candidates_per_thread; ++k) {
+        int size = compose(state, code);
+
+        // NaN losses fail every comparison, as in Verifier.
+        double loss = 0.0;
+        for (unsigned int p = 0; p < num_points && loss < cutoff; ++p) {
+          double delta = derivative_at(code, size, device_xs[p])
+            - device_ys[p];
+          loss += delta * delta;
+        }
+
+        if (loss < cutoff) {
+          auto slot = atomicAdd(&hits->count, 1u);
+          if (slot < max_hits) {
+            hits->sizes[slot] = size;
+            for (int i = 0; i < size; ++i) {
+              hits->codes[slot][i] = code[i];
+            }
+          }
+        }
+      }
+
+      states[t] = state;
+    }
+
+
+    void check(cudaError_t error)
+    {
+      if (error != cudaSuccess) {
+        throw std::runtime_error(std::string("CUDA: ")
+                                 + cudaGetErrorString(error));
+      }
+    }
+
+    struct Free {
+      void operator()(void* p) const { cudaFree(p); }
+    };
+
+    template<typename T>
+    std::unique_ptr<T, Free> allocate_on_device(std::size_t n)
+    {
+      void* p = nullptr;
+      check(cudaMalloc(&p, n * sizeof(T)));
+      return std::unique_ptr<T, Free>(static_cast<T*>(p));
+    }
+
+    // Same as the seeds of the CPU workers
+    uint32_t thread_seed(unsigned int seed, unsigned int id)
+    {
+      uint64_t z = uint64_t{seed} << 32 | id;
+      auto ret = static_cast<uint32_t>(splitmix64(z));
+      return ret != 0 ? ret : 1;
+    }
+
+  } // namespace
+
+
+  std::pair<std::string, unsigned long>
+  gpu_search(const std::vector<Point>& integrand_points,
+             unsigned int seed,
+             unsigned long max_attempts)
+  {
+    assert(!integrand_points.empty());
+
+    auto num_points = std::min<std::size_t>(integrand_points.size(),
+                                            max_device_points);
+    double xs[max_device_points];
+    double ys[max_device_points];
+    for (std::size_t i = 0; i < num_points; ++i) {
+      xs[i] = integrand_points[i].first;
+      ys[i] = integrand_points[i].second;
+    }
+    check(cudaMemcpyToSymbol(device_xs, xs, num_points * sizeof(double)));
+    check(cudaMemcpyToSymbol(device_ys, ys, num_points * sizeof(double)));
+    check(cudaMemcpyToSymbol(device_nullary, nullary_opcodes.data(),
+                             sizeof(nullary_opcodes)));
+    check(cudaMemcpyToSymbol(device_unary, unary_opcodes.data(),
+                             sizeof(unary_opcodes)));
+    check(cudaMemcpyToSymbol(device_binary, binary_opcodes.data(),
+                             sizeof(binary_opcodes)));
+
+    int num_sms = 0;
+    check(cudaDeviceGetAttribute(&num_sms, cudaDevAttrMultiProcessorCount, 0));
+    int blocks_per_sm = 0;
+    check(cudaOccupancyMaxActiveBlocksPerMultiprocessor(&blocks_per_sm, screen,
+                                                        block_size, 0));
+    auto num_blocks = static_cast<unsigned int>(
+      std::max(num_sms * blocks_per_sm, 1));
+    auto num_threads = num_blocks * block_size;
+
+    auto states = std::vector<uint32_t>(num_threads);
+    for (unsigned int i = 0; i < num_threads; ++i) {
+      states[i] = thread_seed(seed, i);
+    }
+    auto device_states = allocate_on_device<uint32_t>(num_threads);
+    check(cudaMemcpy(device_states.get(), states.data(),
+                     num_threads * sizeof(uint32_t), cudaMemcpyHostToDevice));
+    auto device_hits = allocate_on_device<Hits>(1);
+
+    auto verifier = Verifier(integrand_points, Differentiation::automatic,
+                             PointOrder::as_given);
+    auto cutoff = loss_cutoff(Differentiation::automatic);
+    auto attempts_per_launch =
+      static_cast<unsigned long>(num_threads) * candidates_per_thread;
+    auto hits = std::make_unique<Hits>();
+    auto candidate = Candidate{};
+
+    unsigned long num_attempts = 0;
+    while (max_attempts == 0 || num_attempts < max_attempts) {
+      check(cudaMemset(device_hits.get(), 0, sizeof(unsigned int)));
+      screen<<<num_blocks, block_size>>>(device_states.get(), num_points,
+                                         cutoff, device_hits.get());
+      check(cudaGetLastError());
+      check(cudaMemcpy(&hits->count, &device_hits.get()->count,
+                       sizeof(unsigned int), cudaMemcpyDeviceToHost));
+      num_attempts += attempts_per_launch;
+
+      if (hits->count == 0) {
+        continue;
+      }
+      check(cudaMemcpy(hits.get(), device_hits.get(), sizeof(Hits),
+                       cudaMemcpyDeviceToHost));
+      for (unsigned int i = 0; i < std::min(hits->count, max_hits); ++i) {
+        candidate.size = hits->sizes[i];
+        std::copy_n(hits->codes[i], candidate.size, candidate.code.begin());
+        candidate.code[candidate.size] = Opcode::end;
+        if (verifier.is_correct_integral(candidate.bytecode())
+            && is_confirmed(candidate.bytecode(), integrand_points)) {
+          return {candidate.to_string(), num_attempts};
+        }
+      }
+    }
+
+    return {"", num_attempts};
+  }
+
+} // namespace integrator
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "search.h"
+#include <string>
+#include <vector>
+#include <utility>
+
+// Defined to 1 by the builds that compile gpu.cu with nvcc and link the CUDA
+// runtime.
+#ifndef INTEGRATOR_GPU
+#define INTEGRATOR_GPU 0
+#endif
+
+
+namespace integrator {
+
+  //////////////////////////////////////////////////////////////////////////////
+  // The random search on a CUDA device. Every GPU thread owns a xorshift32
+  // stream, composes candidates the way Composer does, and screens them at
+  // the integrand points on dual numbers, all in registers and local memory.
+  // Only the few candidates that pass come back to the host, which verifies
+  // them again with a Verifier before reporting one: the device's libm may
+  // differ from the host's by an ulp or two, and only the host has the last
+  // word.
+  //
+  // Without INTEGRATOR_GPU, gpu_search() is plain search() on the CPU.
+  //////////////////////////////////////////////////////////////////////////////
+
+  inline constexpr bool gpu_is_supported = INTEGRATOR_GPU;
+
+  // Same as search(), on the first CUDA device. Throws std::runtime_error if
+  // the device fails.
+  std::pair<std::string, unsigned long>
+  gpu_search(const std::vector<Point>& integrand_points,
+             unsigned int seed,
+             unsigned long max_attempts);
+
+#if !INTEGRATOR_GPU
+  inline std::pair<std::string, unsigned long>
+  gpu_search(const std::vector<Point>& integrand_points,
+             unsigned int seed,
+             unsigned long max_attempts)
+  {
+    return search(integrand_points, seed, 0, max_attempts);
+  }
+#endif
+
+} // namespace integrator
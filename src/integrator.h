@@ -1,11 +1,21 @@
+#pragma once
+
 #include <array>
 #include <vector>
+#include <span>
 #include <utility>
 #include <string>
+#include <string_view>
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <optional>
 #include <random>
 #include <numbers>
 #include <limits>
+#include <initializer_list>
 #include <boost/circular_buffer.hpp>
 
 
@@ -29,6 +39,124 @@ namespace integrator {
   // Capacity of the circular buffer storing the composed function
   static constexpr auto expr_max_size = 64u;
 
+  // Number of x values evaluated side by side by Composer::eval_batch. Wide
+  // enough to hold the whole derivative stencil (x-dx and x+dx) of 8 points
+  // in one pass.
+  static constexpr auto batch_width = 16u;
+
+
+  // Opcodes of the bytecode form of an expression, one byte each. The order
+  // must match the dispatch table of Composer::run.
+  enum class Opcode : uint8_t {
+    x, zero, one,
+    invert, invert_sign, increment, decrement, sin, cos, tan,
+    square, root, log, halve,
+    add, subtract, multiply, divide,
+    end // Terminates every program, so the interpreter needs no bounds check
+  };
+
+  using Bytecode = std::vector<Opcode>;
+  using BytecodeView = std::span<const Opcode>; // Must end with Opcode::end
+
+  constexpr Opcode opcode_of(char symbol)
+  {
+    switch (symbol) {
+      case 'x': return Opcode::x;
+      case '0': return Opcode::zero;
+      case '1': return Opcode::one;
+      case'\\': return Opcode::invert;
+      case '~': return Opcode::invert_sign;
+      case '>': return Opcode::increment;
+      case '<': return Opcode::decrement;
+      case 'S': return Opcode::sin;
+      case 'C': return Opcode::cos;
+      case 'T': return Opcode::tan;
+      case '2': return Opcode::square;
+      case 'R': return Opcode::root;
+      case 'L': return Opcode::log;
+      case 'H': return Opcode::halve;
+      case '+': return Opcode::add;
+      case '-': return Opcode::subtract;
+      case '*': return Opcode::multiply;
+      case '/': return Opcode::divide;
+    }
+    assert(false);
+  }
+
+  constexpr char symbol_of(Opcode op)
+  {
+    switch (op) {
+      case Opcode::x: return 'x';
+      case Opcode::zero: return '0';
+      case Opcode::one: return '1';
+      case Opcode::invert: return '\\';
+      case Opcode::invert_sign: return '~';
+      case Opcode::increment: return '>';
+      case Opcode::decrement: return '<';
+      case Opcode::sin: return 'S';
+      case Opcode::cos: return 'C';
+      case Opcode::tan: return 'T';
+      case Opcode::square: return '2';
+      case Opcode::root: return 'R';
+      case Opcode::log: return 'L';
+      case Opcode::halve: return 'H';
+      case Opcode::add: return '+';
+      case Opcode::subtract: return '-';
+      case Opcode::multiply: return '*';
+      case Opcode::divide: return '/';
+      case Opcode::end: break;
+    }
+    assert(false);
+  }
+
+  // Number of operands an opcode pops off the stack
+  constexpr int arity(Opcode op)
+  {
+    if (op <= Opcode::one || op == Opcode::end) {
+      return 0;
+    }
+    if (op <= Opcode::halve) {
+      return 1;
+    }
+    return 2;
+  }
+
+  template<std::size_t N>
+  constexpr auto opcodes_of(const std::array<char, N>& symbols)
+  {
+    std::array<Opcode, N> ret{};
+    for (std::size_t i = 0; i < N; ++i) {
+      ret[i] = opcode_of(symbols[i]);
+    }
+    return ret;
+  }
+
+  // The pools above, as opcodes
+  static constexpr auto nullary_opcodes = opcodes_of(nullary_pool);
+  static constexpr auto unary_opcodes = opcodes_of(unary_pool);
+  static constexpr auto binary_opcodes = opcodes_of(binary_pool);
+
+
+  // A composed expression in bytecode, in fixed-capacity storage that the
+  // caller owns and reuses from one candidate to the next, so that composing
+  // doesn't allocate. The textual form is only built on demand, typically for
+  // the one candidate that passes verification.
+  struct Candidate {
+    std::array<Opcode, expr_max_size + 1> code; // Terminated by Opcode::end
+    std::size_t size = 0; // Number of opcodes, without the terminator
+
+    BytecodeView bytecode() const { return {code.data(), size + 1}; }
+
+    std::string to_string() const
+    {
+      std::string ret(size, ' ');
+      for (std::size_t i = 0; i < size; ++i) {
+        ret[i] = symbol_of(code[i]);
+      }
+      return ret;
+    }
+  };
+
 
   // Random number generation lies at the heart of a very hot loop.
   // This class implements the "xor" algorithm from Page 4 of
@@ -37,7 +165,9 @@ namespace integrator {
   public:
     CustomGenerator(uint32_t seed) : state(seed) { assert(seed != 0); }
 
-    using result_type = int;
+    // Unsigned, so that draws are always in [0, n). A signed result made
+    // half of the draws negative and yielded malformed expressions.
+    using result_type = uint32_t;
     static constexpr result_type max() {
       return std::numeric_limits<result_type>::max();
     }
@@ -48,6 +178,9 @@ namespace integrator {
       return xorshift32();
     }
 
+    // The whole state: a generator seeded with it carries on the stream.
+    uint32_t get_state() const { return state; }
+
   private:
     uint32_t state;
 
@@ -62,16 +195,700 @@ namespace integrator {
   };
 
 
+  // The finalizer of splitmix64, which mixes the bits of its argument.
+  constexpr uint64_t mix64(uint64_t z)
+  {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  // Steps *state and returns a well-mixed 64-bit value, to seed a generator
+  // with a large state from a small seed (Steele et al., "Fast splittable
+  // pseudorandom number generators").
+  inline uint64_t splitmix64(uint64_t& state)
+  {
+    return mix64(state += 0x9e3779b97f4a7c15);
+  }
+
+
+  // The xoshiro256++ generator of Blackman and Vigna, "Scrambled Linear
+  // Pseudorandom Number Generators." Its 256 bits of state leave room for
+  // many more independent streams than the 32 bits of CustomGenerator.
+  class Xoshiro256pp {
+  public:
+    Xoshiro256pp(uint32_t seed)
+    {
+      uint64_t z = seed;
+      for (auto& s : state) {
+        s = splitmix64(z);
+      }
+    }
+
+    using result_type = uint32_t;
+    static constexpr result_type max() {
+      return std::numeric_limits<result_type>::max();
+    }
+    static constexpr result_type min() {
+      return 0;
+    }
+    result_type operator()() {
+      return next() >> 32; // The high bits are the best ones
+    }
+
+  private:
+    std::array<uint64_t, 4> state;
+
+    static uint64_t rotl(uint64_t x, int k)
+    {
+      return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t next()
+    {
+      uint64_t result = rotl(state[0] + state[3], 23) + state[0];
+      uint64_t t = state[1] << 17;
+      state[2] ^= state[0];
+      state[3] ^= state[1];
+      state[1] ^= state[2];
+      state[0] ^= state[3];
+      state[2] ^= t;
+      state[3] = rotl(state[3], 45);
+      return result;
+    }
+  };
+
+
+  // W independent xorshift32 streams, stepped together once every W draws.
+  // The stepping loop has a constant trip count, which the compiler turns
+  // into a few SIMD shifts and xors, so that a draw costs a fraction of a
+  // CustomGenerator step.
+  template<std::size_t W = 16>
+  class MultiLaneXorshift {
+  public:
+    MultiLaneXorshift(uint32_t seed)
+    {
+      uint64_t z = seed;
+      for (auto& s : state) {
+        do {
+          s = static_cast<uint32_t>(splitmix64(z));
+        } while (s == 0);
+      }
+    }
+
+    using result_type = uint32_t;
+    static constexpr result_type max() {
+      return std::numeric_limits<result_type>::max();
+    }
+    static constexpr result_type min() {
+      return 0;
+    }
+    result_type operator()() {
+      if (next == W) {
+        step();
+        next = 0;
+      }
+      return state[next++];
+    }
+
+  private:
+    alignas(64) std::array<uint32_t, W> state; // Also the last W draws
+    std::size_t next = W; // Index of the next draw in state
+
+    void step()
+    {
+      for (std::size_t i = 0; i < W; ++i) {
+        uint32_t x = state[i];
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        state[i] = x;
+      }
+    }
+  };
+
+
+  // Draws uniformly from [0, n) with Lemire's multiply-shift, which trades
+  // the division of `rng() % n` for a multiplication. The bias, below
+  // n / 2^32, is negligible for the sizes of the pools.
+  template<typename G>
+  uint32_t draw_below(G& rng, uint32_t n)
+  {
+    return static_cast<uint32_t>((uint64_t{rng()} * n) >> 32);
+  }
+
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Dual numbers, for forward-mode automatic differentiation:
+  //////////////////////////////////////////////////////////////////////////////
+
+  // A value together with its derivative with respect to x. Evaluating an
+  // expression on Dual{x, 1.0} yields its value and its exact derivative at x
+  // in a single pass. Plain numbers convert to constants. The search runs on
+  // doubles, and screens and confirms candidates in other precisions.
+  template<typename R>
+  struct BasicDual {
+    R value = 0;
+    R deriv = 0;
+
+    BasicDual() = default;
+    BasicDual(R value, R deriv = 0) : value{value}, deriv{deriv}
+    { }
+
+    BasicDual& operator+=(const BasicDual& o)
+    {
+      value += o.value;
+      deriv += o.deriv;
+      return *this;
+    }
+
+    BasicDual& operator-=(const BasicDual& o)
+    {
+      value -= o.value;
+      deriv -= o.deriv;
+      return *this;
+    }
+
+    // Both compound products also work when o aliases *this.
+    BasicDual& operator*=(const BasicDual& o)
+    {
+      deriv = deriv * o.value + value * o.deriv;
+      value *= o.value;
+      return *this;
+    }
+
+    BasicDual& operator/=(const BasicDual& o)
+    {
+      R quotient = value / o.value;
+      deriv = (deriv - quotient * o.deriv) / o.value;
+      value = quotient;
+      return *this;
+    }
+
+    friend BasicDual operator/(BasicDual a, const BasicDual& b)
+    {
+      return a /= b;
+    }
+
+    friend BasicDual sin(const BasicDual& a)
+    {
+      return {std::sin(a.value), std::cos(a.value) * a.deriv};
+    }
+
+    friend BasicDual cos(const BasicDual& a)
+    {
+      return {std::cos(a.value), -std::sin(a.value) * a.deriv};
+    }
+
+    friend BasicDual tan(const BasicDual& a)
+    {
+      R t = std::tan(a.value);
+      return {t, (1 + t * t) * a.deriv};
+    }
+
+    friend BasicDual sqrt(const BasicDual& a)
+    {
+      R r = std::sqrt(a.value);
+      return {r, a.deriv / (2 * r)};
+    }
+
+    friend BasicDual log(const BasicDual& a)
+    {
+      return {std::log(a.value), a.deriv / a.value};
+    }
+  };
+
+  using Dual = BasicDual<double>;
+
+  template<typename S>
+  inline constexpr bool is_dual_v = false;
+
+  template<typename R>
+  inline constexpr bool is_dual_v<BasicDual<R>> = true;
+
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Operator kernels, shared by all evaluators. They are generic, so that the
+  // very same code runs on doubles and on dual numbers.
+  //////////////////////////////////////////////////////////////////////////////
+
+  namespace kernels {
+    inline constexpr auto invert = [](auto& v) { v = 1.0 / v; };
+    inline constexpr auto invert_sign = [](auto& v) { v *= -1.0; };
+    inline constexpr auto increment = [](auto& v) { v += 1.0; };
+    inline constexpr auto decrement = [](auto& v) { v -= 1.0; };
+    inline constexpr auto sin = [](auto& v) { using std::sin; v = sin(v); };
+    inline constexpr auto cos = [](auto& v) { using std::cos; v = cos(v); };
+    inline constexpr auto tan = [](auto& v) { using std::tan; v = tan(v); };
+    inline constexpr auto square = [](auto& v) { v *= v; };
+    inline constexpr auto root = [](auto& v) { using std::sqrt; v = sqrt(v); };
+    inline constexpr auto log = [](auto& v) { using std::log; v = log(v); };
+    inline constexpr auto halve = [](auto& v) { v /= 2.0; };
+
+    inline constexpr auto add = [](auto& a, const auto& b) { a += b; };
+    inline constexpr auto subtract = [](auto& a, const auto& b) { a -= b; };
+    inline constexpr auto multiply = [](auto& a, const auto& b) { a *= b; };
+    inline constexpr auto divide = [](auto& a, const auto& b) { a /= b; };
+
+    // Calls `f` with the kernel of a unary, or binary, operator.
+    template<typename F>
+    void with_unary(Opcode op, F&& f)
+    {
+      switch (op) {
+        case Opcode::invert: f(invert); return;
+        case Opcode::invert_sign: f(invert_sign); return;
+        case Opcode::increment: f(increment); return;
+        case Opcode::decrement: f(decrement); return;
+        case Opcode::sin: f(sin); return;
+        case Opcode::cos: f(cos); return;
+        case Opcode::tan: f(tan); return;
+        case Opcode::square: f(square); return;
+        case Opcode::root: f(root); return;
+        case Opcode::log: f(log); return;
+        case Opcode::halve: f(halve); return;
+        default: break;
+      }
+      assert(false);
+    }
+
+    template<typename F>
+    void with_binary(Opcode op, F&& f)
+    {
+      switch (op) {
+        case Opcode::add: f(add); return;
+        case Opcode::subtract: f(subtract); return;
+        case Opcode::multiply: f(multiply); return;
+        case Opcode::divide: f(divide); return;
+        default: break;
+      }
+      assert(false);
+    }
+  } // namespace kernels
+
+
+  //////////////////////////////////////////////////////////////////////////////
+  // This class is responsible for evaluating expressions in bytecode.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class Evaluator {
+  public:
+    static double eval(BytecodeView code, double x)
+    {
+      double ret;
+      run(code.data(), x, ret);
+      return ret;
+    }
+
+
+    // Same as eval, but gives up as soon as an operator yields a non-finite
+    // value (NaN from log or sqrt of a negative, inf from a division by zero,
+    // overflow, ...), in which case it returns nothing.
+    static std::optional<double> eval_checked(BytecodeView code, double x)
+    {
+      double ret;
+      if (!run<true>(code.data(), x, ret)) {
+        return std::nullopt;
+      }
+      return ret;
+    }
+
+
+    // Evaluates an expression and its exact derivative at x in one pass, in
+    // the precision of R.
+    template<typename R = double>
+    static BasicDual<R> eval_dual(BytecodeView code, double x)
+    {
+      BasicDual<R> ret;
+      run(code.data(), variable<BasicDual<R>>(x), ret);
+      return ret;
+    }
+
+
+    // Same as eval_dual, but gives up as soon as an operator yields a
+    // non-finite value or derivative.
+    template<typename R = double>
+    static std::optional<BasicDual<R>> eval_dual_checked(BytecodeView code,
+                                                         double x)
+    {
+      BasicDual<R> ret;
+      if (!run<true>(code.data(), variable<BasicDual<R>>(x), ret)) {
+        return std::nullopt;
+      }
+      return ret;
+    }
+
+
+    // Evaluates an expression at every value of xs, and stores the results
+    // in ys. The program is run once per block of batch_width values instead
+    // of once per value. Passing dual numbers as ys also yields the exact
+    // derivatives.
+    static void eval_batch(BytecodeView code,
+                           std::span<const double> xs,
+                           std::span<double> ys)
+    {
+      run_batch(code, xs, ys);
+    }
+
+    static void eval_batch(BytecodeView code,
+                           std::span<const double> xs,
+                           std::span<Dual> ys)
+    {
+      run_batch(code, xs, ys);
+    }
+
+
+    // Same as eval_batch, but gives up as soon as an operator yields a
+    // non-finite value in any lane, in which case it returns false and the
+    // content of ys is unspecified.
+    static bool eval_batch_checked(BytecodeView code,
+                                   std::span<const double> xs,
+                                   std::span<double> ys)
+    {
+      return run_batch<true>(code, xs, ys);
+    }
+
+    static bool eval_batch_checked(BytecodeView code,
+                                   std::span<const double> xs,
+                                   std::span<Dual> ys)
+    {
+      return run_batch<true>(code, xs, ys);
+    }
+
+
+    // Compiles an expression into the one-byte opcodes run by the bytecode
+    // interpreter.
+    static Bytecode compile_bytecode(std::string_view expr)
+    {
+      assert(expr.size() <= expr_max_size);
+
+      Bytecode ret;
+      ret.reserve(expr.size() + 1);
+
+      for (char c : expr) {
+        ret.push_back(opcode_of(c));
+      }
+      ret.push_back(Opcode::end);
+
+      return ret;
+    }
+
+
+  private:
+    // One operand per lane of a batch
+    template<typename S>
+    using Lanes = std::array<S, batch_width>;
+
+    // Bytecode interpreter, shared by the scalar (T = double or BasicDual)
+    // and the batched (T = Lanes<double> or Lanes<Dual>) evaluators. Operands
+    // live in a fixed-size local array, and each opcode jumps straight to the
+    // next one through a table of label addresses, which gives every opcode
+    // its own indirect branch to predict.
+    // For T = Lanes<...>, the kernel loops have a constant trip count of
+    // batch_width, so the compiler emits packed SSE/AVX2/AVX-512 code for the
+    // arithmetic and sqrt kernels (and libmvec calls for the transcendental
+    // ones when built with -ffast-math).
+    //
+    // In checked mode, the result of every operator that can turn finite
+    // operands into a non-finite value is tested, and the interpreter returns
+    // false at the first one that fails. The test compiles away otherwise.
+    template<bool checked = false, typename T>
+    static bool run(const Opcode* pc, const T& x, T& result)
+    {
+      T operands[expr_max_size];
+      T* sp = operands; // One past the top of the stack
+
+#if defined(__GNUC__)
+      static void* const dispatch_table[] = {
+        &&op_x, &&op_zero, &&op_one,
+        &&op_invert, &&op_invert_sign, &&op_increment, &&op_decrement,
+        &&op_sin, &&op_cos, &&op_tan,
+        &&op_square, &&op_root, &&op_log, &&op_halve,
+        &&op_add, &&op_subtract, &&op_multiply, &&op_divide,
+        &&op_end};
+#  define INTEGRATOR_OP(name) op_##name
+#  define INTEGRATOR_NEXT goto *dispatch_table[static_cast<uint8_t>(*pc++)]
+#  define INTEGRATOR_CHECKED_NEXT \
+      { if (checked && !is_finite(sp[-1])) return false; } INTEGRATOR_NEXT
+      INTEGRATOR_NEXT;
+      {
+#else
+#  define INTEGRATOR_OP(name) case Opcode::name
+#  define INTEGRATOR_NEXT goto dispatch
+#  define INTEGRATOR_CHECKED_NEXT \
+      { if (checked && !is_finite(sp[-1])) return false; } INTEGRATOR_NEXT
+      dispatch:
+      switch (*pc++) {
+#endif
+        INTEGRATOR_OP(x): *sp++ = x; INTEGRATOR_NEXT;
+        INTEGRATOR_OP(zero): *sp++ = constant<T>(0.0); INTEGRATOR_NEXT;
+        INTEGRATOR_OP(one): *sp++ = constant<T>(1.0); INTEGRATOR_NEXT;
+
+        INTEGRATOR_OP(invert):
+          apply(sp[-1], kernels::invert);
+          INTEGRATOR_CHECKED_NEXT;
+        INTEGRATOR_OP(invert_sign):
+          apply(sp[-1], kernels::invert_sign);
+          INTEGRATOR_NEXT;
+        INTEGRATOR_OP(increment):
+          apply(sp[-1], kernels::increment);
+          INTEGRATOR_NEXT;
+        INTEGRATOR_OP(decrement):
+          apply(sp[-1], kernels::decrement);
+          INTEGRATOR_NEXT;
+        INTEGRATOR_OP(sin):
+          apply(sp[-1], kernels::sin);
+          INTEGRATOR_NEXT;
+        INTEGRATOR_OP(cos):
+          apply(sp[-1], kernels::cos);
+          INTEGRATOR_NEXT;
+        INTEGRATOR_OP(tan):
+          apply(sp[-1], kernels::tan);
+          INTEGRATOR_CHECKED_NEXT;
+        INTEGRATOR_OP(square):
+          apply(sp[-1], kernels::square);
+          INTEGRATOR_CHECKED_NEXT;
+        INTEGRATOR_OP(root):
+          apply(sp[-1], kernels::root);
+          INTEGRATOR_CHECKED_NEXT;
+        INTEGRATOR_OP(log):
+          apply(sp[-1], kernels::log);
+          INTEGRATOR_CHECKED_NEXT;
+        INTEGRATOR_OP(halve):
+          apply(sp[-1], kernels::halve);
+          INTEGRATOR_NEXT;
+
+        INTEGRATOR_OP(add):
+          --sp;
+          apply(sp[-1], sp[0], kernels::add);
+          INTEGRATOR_CHECKED_NEXT;
+        INTEGRATOR_OP(subtract):
+          --sp;
+          apply(sp[-1], sp[0], kernels::subtract);
+          INTEGRATOR_CHECKED_NEXT;
+        INTEGRATOR_OP(multiply):
+          --sp;
+          apply(sp[-1], sp[0], kernels::multiply);
+          INTEGRATOR_CHECKED_NEXT;
+        INTEGRATOR_OP(divide):
+          --sp;
+          apply(sp[-1], sp[0], kernels::divide);
+          INTEGRATOR_CHECKED_NEXT;
+
+        INTEGRATOR_OP(end): goto done;
+      }
+#undef INTEGRATOR_OP
+#undef INTEGRATOR_NEXT
+#undef INTEGRATOR_CHECKED_NEXT
+
+    done:
+      assert(sp == operands + 1);
+      result = operands[0];
+      return true;
+    }
+
+    // Largest number of values that run_batch evaluates without lanes
+    static constexpr auto max_scalar_run = 2u;
+
+    template<bool checked = false, typename S>
+    static bool run_batch(BytecodeView code,
+                          std::span<const double> xs,
+                          std::span<S> ys)
+    {
+      assert(xs.size() == ys.size());
+
+      for (std::size_t i = 0; i < xs.size(); i += batch_width) {
+        auto n = std::min<std::size_t>(batch_width, xs.size() - i);
+
+        // A handful of values are cheaper to evaluate one by one than by
+        // running all the lanes.
+        if (n <= max_scalar_run) {
+          for (std::size_t j = i; j < i + n; ++j) {
+            if (!run<checked>(code.data(), variable<S>(xs[j]), ys[j])) {
+              return false;
+            }
+          }
+          continue;
+        }
+
+        // Unused lanes repeat the last value rather than hold garbage that
+        // could raise floating-point exceptions.
+        alignas(64) Lanes<S> x_batch;
+        for (std::size_t j = 0; j < batch_width; ++j) {
+          x_batch[j] = variable<S>(xs[i + std::min(j, n - 1)]);
+        }
+
+        alignas(64) Lanes<S> y_batch;
+        if (!run<checked>(code.data(), x_batch, y_batch)) {
+          return false;
+        }
+        std::copy_n(y_batch.begin(), n, ys.begin() + i);
+      }
+
+      return true;
+    }
+
+  protected:
+    // The value of the variable x, resp. of a constant, as an operand of type
+    // S, which is either a scalar or lanes of scalars.
+    template<typename S>
+    static S variable(double x)
+    {
+      if constexpr (is_dual_v<S>) {
+        return {static_cast<decltype(S::value)>(x), 1};
+      } else {
+        return x;
+      }
+    }
+
+    template<typename S>
+    static S constant(double v)
+    {
+      if constexpr (std::is_same_v<S, Lanes<double>>
+                    || std::is_same_v<S, Lanes<Dual>>) {
+        S ret;
+        ret.fill(v);
+        return ret;
+      } else {
+        return v;
+      }
+    }
+
+    template<typename S, typename F>
+    static void apply(S& a, const F& f)
+    {
+      f(a);
+    }
+
+    template<typename S, typename F>
+    static void apply(S& a, const S& b, const F& f)
+    {
+      f(a, b);
+    }
+
+    template<typename S, typename F>
+    static void apply(Lanes<S>& a, const F& f)
+    {
+      for (std::size_t i = 0; i < batch_width; ++i) {
+        f(a[i]);
+      }
+    }
+
+    template<typename S, typename F>
+    static void apply(Lanes<S>& a, const Lanes<S>& b, const F& f)
+    {
+      for (std::size_t i = 0; i < batch_width; ++i) {
+        f(a[i], b[i]);
+      }
+    }
+
+    static bool is_finite(double v)
+    {
+      return std::isfinite(v);
+    }
+
+    template<typename R>
+    static bool is_finite(const BasicDual<R>& v)
+    {
+      return std::isfinite(v.value) && std::isfinite(v.deriv);
+    }
+
+    template<typename S>
+    static bool is_finite(const Lanes<S>& a)
+    {
+      bool ret = true;
+      for (std::size_t i = 0; i < batch_width; ++i) {
+        ret &= is_finite(a[i]);
+      }
+      return ret;
+    }
+  };
+
+
   //////////////////////////////////////////////////////////////////////////////
-  // This class is responsible for composing and evaluating expressions.
+  // Evaluates, at a fixed x, programs that share a prefix with the previous
+  // one, as when they are enumerated in order. The value of every subexpression
+  // of the last program is kept, along with the one below it on the stack,
+  // which together make up the operand stack after every prefix. Resuming
+  // after the shared prefix then costs one operator per opcode that changed,
+  // instead of one per opcode.
   //////////////////////////////////////////////////////////////////////////////
 
-  class Composer;
-  using MemberFuncPtr = void(Composer::*)();
+  template<typename S>
+  class PrefixEvaluator : public Evaluator {
+  public:
+    explicit PrefixEvaluator(double x) : x{variable<S>(x)} { }
+
+    // Evaluates `code`, whose first `from` opcodes must be those of the last
+    // program evaluated. Like eval_checked, gives up as soon as an operator
+    // yields a non-finite value, in which case it returns nothing.
+    std::optional<S> eval(BytecodeView code, std::size_t from)
+    {
+      if (from > num_finite) {
+        return std::nullopt; // The shared prefix already wasn't finite
+      }
+
+      auto pos = from;
+      for (; code[pos] != Opcode::end; ++pos) {
+        auto op = code[pos];
+        auto top = pos - 1; // Only read if there is an operand
+
+        switch (arity(op)) {
+          case 0:
+            values[pos] = op == Opcode::x
+              ? x
+              : constant<S>(op == Opcode::one ? 1.0 : 0.0);
+            below[pos] = top;
+            break;
+          case 1:
+            values[pos] = values[top];
+            kernels::with_unary(op, [this, pos](const auto& kernel) {
+              apply(values[pos], kernel);
+            });
+            below[pos] = below[top];
+            break;
+          case 2: {
+            auto lhs = below[top];
+            values[pos] = values[lhs];
+            kernels::with_binary(op, [this, pos, top](const auto& kernel) {
+              apply(values[pos], values[top], kernel);
+            });
+            below[pos] = below[lhs];
+            break;
+          }
+        }
+
+        if (!is_finite(values[pos])) {
+          num_finite = pos;
+          return std::nullopt;
+        }
+      }
+
+      num_finite = pos;
+      return values[pos - 1];
+    }
+
+  private:
+    S x;
+    // Value of the subexpression ending at each opcode of the last program,
+    // and position of the one right below it on the stack (garbage if none)
+    std::array<S, expr_max_size> values;
+    std::array<std::size_t, expr_max_size> below;
+    std::size_t num_finite = 0; // Leading values known to be finite
+  };
+
+
+  //////////////////////////////////////////////////////////////////////////////
+  // This class is responsible for composing and evaluating expressions. The
+  // random generator is a policy: any class constructible from a non-zero
+  // uint32_t seed, and whose operator() returns 32 uniformly random bits.
+  //////////////////////////////////////////////////////////////////////////////
 
-  class Composer {
+  template<typename Generator>
+  class BasicComposer : public Evaluator {
   public:
-    Composer(unsigned int rng_seed)
+    using MemberFuncPtr = void(BasicComposer::*)();
+
+    BasicComposer(unsigned int rng_seed)
       : stack(expr_max_size),
       rng{rng_seed}
     { }
@@ -80,12 +897,19 @@ namespace integrator {
     std::pair<std::string, std::vector<MemberFuncPtr>>
     compose(int tentative_len)
     {
-      int len = (rng() % tentative_len) + 2;
-      auto raw_expr = gen_random_expr(len);
+      auto raw_expr = gen_random_expr(draw_len(tentative_len));
       return {raw_expr, compile(raw_expr)};
     }
 
 
+    // Same as compose, but the expression is written to `candidate`, and
+    // directly in bytecode.
+    void compose(int tentative_len, Candidate& candidate)
+    {
+      gen_random_code(draw_len(tentative_len), candidate);
+    }
+
+
     double eval(const std::vector<MemberFuncPtr>& compiled_expr, double x)
     {
       x_value = x;
@@ -93,11 +917,30 @@ namespace integrator {
     }
 
 
+    using Evaluator::eval;
+
+
+    const Generator& generator() const { return rng; }
+
+
     std::string gen_random_expr(int len)
     {
-      std::string result;
+      Candidate candidate;
+      gen_random_code(len, candidate);
+      return candidate.to_string();
+    }
 
 
+    // Same as gen_random_expr, but emits opcodes rather than symbols.
+    void gen_random_code(int len, Candidate& candidate)
+    {
+      // The trailing binary operators at most double the length.
+      assert(2*len - 1 <= int{expr_max_size});
+
+      auto& result = candidate.code;
+      auto& size = candidate.size;
+      size = 0;
+
       int stack_size = 0; // Used to ensure that the generated expression,
       // after getting fully executed, leaves a stack
       // with size 1, i.e., a stack containing only
@@ -105,7 +948,7 @@ namespace integrator {
 
       for (int i = 0; i < len; ++i) {
         int roof = stack_size>=2 ? 3 : stack_size+1;
-        int choice = rng() % roof;
+        int choice = draw_below(rng, roof);
 
         if (i == len-1)
         {
@@ -117,25 +960,75 @@ namespace integrator {
 
         switch (choice) {
           case 0:
-            result += draw_random_symbol(nullary_pool);
+            result[size++] = draw_random_symbol(nullary_opcodes);
             stack_size++;
             break;
           case 1:
-            result += draw_random_symbol(unary_pool);
+            result[size++] = draw_random_symbol(unary_opcodes);
             break;
           case 2:
-            result += draw_random_symbol(binary_pool);
+            result[size++] = draw_random_symbol(binary_opcodes);
             stack_size--;
             break;
         }
       }
 
       while (stack_size > 1) {
-        result += draw_random_symbol(binary_pool);
+        result[size++] = draw_random_symbol(binary_opcodes);
         stack_size--;
       }
 
-      return result;
+      result[size] = Opcode::end;
+    }
+
+
+    // Writes to `child` a copy of `parent` that differs by one point mutation:
+    // an opcode swapped for another of the same arity, or a unary opcode, or a
+    // nullary and binary pair, inserted or deleted. Those leave the stack as
+    // it was. Returns the position of the first opcode that changed.
+    std::size_t mutate(const Candidate& parent, Candidate& child)
+    {
+      child = parent;
+      auto& code = child.code;
+      auto pos = std::size_t{draw_below(rng, parent.size)};
+
+      switch (draw_below(rng, 3)) {
+        case 0:
+          break;
+        case 1:
+          // Past the first opcode, there is always an operand to apply to.
+          if (child.size + 2 <= expr_max_size) {
+            ++pos;
+            if (draw_below(rng, 2) == 0) {
+              insert(child, pos, {draw_random_symbol(unary_opcodes)});
+            } else {
+              insert(child, pos, {draw_random_symbol(nullary_opcodes),
+                                  draw_random_symbol(binary_opcodes)});
+            }
+            return pos;
+          }
+          break;
+        case 2:
+          if (arity(code[pos]) == 1) {
+            erase(child, pos, 1);
+            return pos;
+          }
+          if (arity(code[pos]) == 0 && arity(code[pos+1]) == 2) {
+            erase(child, pos, 2);
+            return pos;
+          }
+          if (arity(code[pos]) == 2 && arity(code[pos-1]) == 0) {
+            erase(child, pos-1, 2);
+            return pos-1;
+          }
+          break; // Nothing to delete there
+      }
+
+      auto op = code[pos];
+      code[pos] = arity(op) == 0 ? draw_other_symbol(nullary_opcodes, op)
+        : arity(op) == 1 ? draw_other_symbol(unary_opcodes, op)
+        : draw_other_symbol(binary_opcodes, op);
+      return pos;
     }
 
 
@@ -156,31 +1049,30 @@ namespace integrator {
   private:
     double x_value;
     boost::circular_buffer<double> stack; // Stack of operands
-    // std::ranlux24_base rng;
-    CustomGenerator rng;
+    Generator rng;
 
 
     static MemberFuncPtr operator_dict(char c)
     {
       switch (c) {
-        case 'x': return &Composer::x;
-        case '0': return &Composer::zero;
-        case '1': return &Composer::one;
-        case'\\': return &Composer::invert;
-        case '~': return &Composer::invert_sign;
-        case '>': return &Composer::increment;
-        case '<': return &Composer::decrement;
-        case 'S': return &Composer::sin;
-        case 'C': return &Composer::cos;
-        case 'T': return &Composer::tan;
-        case '2': return &Composer::square;
-        case 'R': return &Composer::root;
-        case 'L': return &Composer::log;
-        case 'H': return &Composer::halve;
-        case '+': return &Composer::add;
-        case '-': return &Composer::subtract;
-        case '*': return &Composer::multiply;
-        case '/': return &Composer::divide;
+        case 'x': return &BasicComposer::x;
+        case '0': return &BasicComposer::zero;
+        case '1': return &BasicComposer::one;
+        case'\\': return &BasicComposer::invert;
+        case '~': return &BasicComposer::invert_sign;
+        case '>': return &BasicComposer::increment;
+        case '<': return &BasicComposer::decrement;
+        case 'S': return &BasicComposer::sin;
+        case 'C': return &BasicComposer::cos;
+        case 'T': return &BasicComposer::tan;
+        case '2': return &BasicComposer::square;
+        case 'R': return &BasicComposer::root;
+        case 'L': return &BasicComposer::log;
+        case 'H': return &BasicComposer::halve;
+        case '+': return &BasicComposer::add;
+        case '-': return &BasicComposer::subtract;
+        case '*': return &BasicComposer::multiply;
+        case '/': return &BasicComposer::divide;
       }
       assert(false);
     }
@@ -205,28 +1097,66 @@ namespace integrator {
     void zero() { stack.push_back(0.0); }    // push the number 0
     void one() { stack.push_back(1.0); }     // push the number 1
 
-    void invert() { apply_unary([](double& v) { v = 1.0 / v; }); }
-    void invert_sign() { apply_unary([](double& v) { v *= -1.0; }); }
-    void increment() { apply_unary([](double& v) { v += 1.0; }); }
-    void decrement() { apply_unary([](double& v) { v -= 1.0; }); }
-    void sin() { apply_unary([](double& v) { v = std::sin(v); }); }
-    void cos() { apply_unary([](double& v) { v = std::cos(v); }); }
-    void tan() { apply_unary([](double& v) { v = std::tan(v); }); }
-    void square() { apply_unary([](double& v) { v *= v; }); }
-    void root() { apply_unary([](double& v) { v = std::sqrt(v); }); }
-    void log() { apply_unary([](double& v) { v = std::log(v); }); }
-    void halve() { apply_unary([](double& v) { v /= 2.0; }); }
-
-    void add() { apply_binary([](double& a, const double& b) { a += b; }); }
-    void subtract() { apply_binary([](double& a, const double& b) { a -= b; }); }
-    void multiply() { apply_binary([](double& a, const double& b) { a *= b; }); }
-    void divide() { apply_binary([](double& a, const double& b) { a /= b; }); }
+    void invert() { apply_unary(kernels::invert); }
+    void invert_sign() { apply_unary(kernels::invert_sign); }
+    void increment() { apply_unary(kernels::increment); }
+    void decrement() { apply_unary(kernels::decrement); }
+    void sin() { apply_unary(kernels::sin); }
+    void cos() { apply_unary(kernels::cos); }
+    void tan() { apply_unary(kernels::tan); }
+    void square() { apply_unary(kernels::square); }
+    void root() { apply_unary(kernels::root); }
+    void log() { apply_unary(kernels::log); }
+    void halve() { apply_unary(kernels::halve); }
+
+    void add() { apply_binary(kernels::add); }
+    void subtract() { apply_binary(kernels::subtract); }
+    void multiply() { apply_binary(kernels::multiply); }
+    void divide() { apply_binary(kernels::divide); }
+
+    // Draws the length of the next expression from [2, tentative_len+1].
+    int draw_len(int tentative_len)
+    {
+      return draw_below(rng, tentative_len) + 2;
+    }
 
     // returns a random member of an array
     template<typename T>
-    char draw_random_symbol(const T& arr)
+    typename T::value_type draw_random_symbol(const T& arr)
     {
-      return arr[rng() % arr.size()];
+      return arr[draw_below(rng, arr.size())];
+    }
+
+    // Same, but never `op`, unless it is all there is
+    template<typename T>
+    typename T::value_type draw_other_symbol(const T& arr,
+                                             typename T::value_type op)
+    {
+      auto it = std::find(arr.begin(), arr.end(), op);
+      if (it == arr.end() || arr.size() == 1) {
+        return draw_random_symbol(arr);
+      }
+      auto i = std::size_t{draw_below(rng, arr.size() - 1)};
+      return arr[i < std::size_t(it - arr.begin()) ? i : i + 1];
+    }
+
+    // Makes room for `ops` at `pos`, moving the rest and the terminator along.
+    static void insert(Candidate& candidate, std::size_t pos,
+                       std::initializer_list<Opcode> ops)
+    {
+      auto& code = candidate.code;
+      auto last = code.begin() + candidate.size + 1;
+      std::copy_backward(code.begin() + pos, last, last + ops.size());
+      std::copy(ops.begin(), ops.end(), code.begin() + pos);
+      candidate.size += ops.size();
+    }
+
+    static void erase(Candidate& candidate, std::size_t pos, std::size_t n)
+    {
+      auto& code = candidate.code;
+      std::copy(code.begin() + pos + n, code.begin() + candidate.size + 1,
+                code.begin() + pos);
+      candidate.size -= n;
     }
 
 
@@ -243,4 +1173,8 @@ namespace integrator {
   };
 
 
+  using Composer = BasicComposer<CustomGenerator>;
+  using MemberFuncPtr = Composer::MemberFuncPtr;
+
+
 } // namespace integrator
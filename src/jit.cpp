@@ -0,0 +1,450 @@
+///////////////////////////////////////////////////////////////////////////////
+/////////////////////////        jit.cpp         //////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+//
+// A tiny x86-64 emitter for the System V ABI. Operand i of the stack lives in
+// xmm(2i) for its value and xmm(2i+1) for its derivative, xmm12 accumulates
+// the finiteness checks, and xmm13-15 are scratch. Every xmm register is
+// caller-saved, so the live ones are spilled to the frame around the calls to
+// libm for sin, cos, tan and log.
+//
+// Frame, from rsp: x, the output pointer, the spilled registers, and two
+// temporaries.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "jit.h"
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#if INTEGRATOR_JIT
+#include <sys/mman.h>
+#endif
+
+
+namespace integrator {
+
+#if INTEGRATOR_JIT
+
+  namespace {
+
+    constexpr std::size_t buffer_size = std::size_t{1} << 16;
+
+    // The constants come first in the buffer, and the code right after.
+    constexpr double constants[] = {0.0, 1.0, -1.0, 2.0};
+    enum Constant { c_zero, c_one, c_minus_one, c_two };
+    constexpr std::size_t code_offset = 64;
+
+    constexpr int acc = 12;
+    constexpr int s0 = 13, s1 = 14, s2 = 15; // Scratch
+
+    constexpr int x_disp = 0;
+    constexpr int out_disp = 8;
+    constexpr int spill_disp = 16; // Up to and including acc
+    constexpr int tmp_disp = spill_disp + 8 * (acc + 1);
+    constexpr int frame_size = tmp_disp + 16;
+    static_assert(frame_size % 16 == 8, "Calls need rsp aligned on 16 bytes");
+
+    int value_reg(std::size_t i) { return 2 * i; }
+    int deriv_reg(std::size_t i) { return 2 * i + 1; }
+
+    // Opcodes of the scalar double instructions, all prefixed with F2 0F
+    enum Sse : uint8_t {
+      movsd = 0x10, movsd_store = 0x11, sqrtsd = 0x51,
+      addsd = 0x58, mulsd = 0x59, subsd = 0x5c, divsd = 0x5e,
+    };
+
+    class Assembler {
+    public:
+      std::vector<uint8_t> bytes;
+
+      // op reg, rm
+      void sse(Sse op, int reg, int rm)
+      {
+        emit(0xf2);
+        rex(reg, rm);
+        emit({0x0f, op, modrm(3, reg, rm)});
+      }
+
+      // op reg, [rsp + disp], or op [rsp + disp], reg to store
+      void sse_frame(Sse op, int reg, int disp)
+      {
+        emit(0xf2);
+        rex(reg, 0);
+        emit({0x0f, op, modrm(2, reg, 4), 0x24});
+        emit32(disp);
+      }
+
+      void sse_constant(Sse op, int reg, Constant c)
+      {
+        emit(0xf2);
+        rex(reg, 0);
+        emit({0x0f, op, modrm(0, reg, 5)});
+        // Relative to the end of the instruction
+        auto end = code_offset + bytes.size() + 4;
+        emit32(static_cast<int>(8 * c) - static_cast<int>(end));
+      }
+
+      void move(int dst, int src)
+      {
+        if (dst != src) {
+          sse(movsd, dst, src);
+        }
+      }
+
+      // acc += (reg - reg), which is NaN unless reg is finite
+      void check(int reg)
+      {
+        move(s2, reg);
+        sse(subsd, s2, reg);
+        sse(addsd, acc, s2);
+      }
+
+      // Calls f(arg) with the first `num_live` registers and acc preserved,
+      // and leaves the result in xmm0.
+      void call(double (*f)(double), int arg, int num_live)
+      {
+        spill(num_live);
+        move(0, arg);
+        emit({0x48, 0xb8}); // mov rax, imm64
+        auto address = reinterpret_cast<uint64_t>(f);
+        for (int i = 0; i < 8; ++i) {
+          emit(static_cast<uint8_t>(address >> (8 * i)));
+        }
+        emit({0xff, 0xd0}); // call rax
+      }
+
+      void spill(int num_live)
+      {
+        for (int reg = 0; reg < num_live; ++reg) {
+          sse_frame(movsd_store, reg, spill_disp + 8 * reg);
+        }
+        sse_frame(movsd_store, acc, spill_disp + 8 * acc);
+      }
+
+      void reload(int num_live)
+      {
+        for (int reg = 0; reg < num_live; ++reg) {
+          sse_frame(movsd, reg, spill_disp + 8 * reg);
+        }
+        sse_frame(movsd, acc, spill_disp + 8 * acc);
+      }
+
+      void emit(uint8_t byte) { bytes.push_back(byte); }
+
+      void emit(std::initializer_list<uint8_t> some_bytes)
+      {
+        bytes.insert(bytes.end(), some_bytes);
+      }
+
+      void emit32(int32_t v)
+      {
+        for (int i = 0; i < 4; ++i) {
+          emit(static_cast<uint8_t>(static_cast<uint32_t>(v) >> (8 * i)));
+        }
+      }
+
+    private:
+      static uint8_t modrm(int mod, int reg, int rm)
+      {
+        return static_cast<uint8_t>(mod << 6 | (reg & 7) << 3 | (rm & 7));
+      }
+
+      void rex(int reg, int rm)
+      {
+        if (reg >= 8 || rm >= 8) {
+          emit(static_cast<uint8_t>(0x40 | (reg >> 3) << 2 | (rm >> 3)));
+        }
+      }
+    };
+
+    double call_sin(double v) { return std::sin(v); }
+    double call_cos(double v) { return std::cos(v); }
+    double call_tan(double v) { return std::tan(v); }
+    double call_log(double v) { return std::log(v); }
+
+    // Emits the body of the function for `code`, mirroring the operators of
+    // Dual. Returns false if the stack gets too deep.
+    bool emit_program(Assembler& a, BytecodeView code)
+    {
+      std::size_t depth = 0;
+
+      for (auto op : code) {
+        if (op == Opcode::end) {
+          break;
+        }
+
+        if (arity(op) == 0) {
+          if (++depth > Jit::max_depth) {
+            return false;
+          }
+          auto v = value_reg(depth - 1);
+          auto d = deriv_reg(depth - 1);
+          if (op == Opcode::x) {
+            a.sse_frame(movsd, v, x_disp);
+            a.sse_constant(movsd, d, c_one);
+          } else {
+            a.sse_constant(movsd, v, op == Opcode::one ? c_one : c_zero);
+            a.sse_constant(movsd, d, c_zero);
+          }
+          continue;
+        }
+
+        auto v = value_reg(depth - 1);
+        auto d = deriv_reg(depth - 1);
+        auto num_live = static_cast<int>(2 * depth);
+
+        // The first operand of a binary operator, v and d being the second
+        auto va = arity(op) == 2 ? value_reg(depth - 2) : -1;
+        auto da = arity(op) == 2 ? deriv_reg(depth - 2) : -1;
+
+        switch (op) {
+          case Opcode::invert: // 1 / v
+            a.sse_constant(movsd, s0, c_one);
+            a.sse(divsd, s0, v);
+            a.sse_constant(movsd, s1, c_zero);
+            a.move(s2, s0);
+            a.sse(mulsd, s2, d);
+            a.sse(subsd, s1, s2);
+            a.sse(divsd, s1, v);
+            a.move(d, s1);
+            a.move(v, s0);
+            break;
+          case Opcode::invert_sign: // v * -1
+            a.move(s0, d);
+            a.sse_constant(mulsd, s0, c_minus_one);
+            a.move(s1, v);
+            a.sse_constant(mulsd, s1, c_zero);
+            a.sse(addsd, s0, s1);
+            a.move(d, s0);
+            a.sse_constant(mulsd, v, c_minus_one);
+            break;
+          case Opcode::increment:
+            a.sse_constant(addsd, v, c_one);
+            a.sse_constant(addsd, d, c_zero);
+            break;
+          case Opcode::decrement:
+            a.sse_constant(subsd, v, c_one);
+            a.sse_constant(subsd, d, c_zero);
+            break;
+          case Opcode::sin: // sin(v), cos(v) d
+            a.call(call_sin, v, num_live);
+            a.sse_frame(movsd_store, 0, tmp_disp);
+            a.reload(num_live);
+            a.call(call_cos, v, num_live);
+            a.move(s0, 0);
+            a.reload(num_live);
+            a.sse(mulsd, s0, d);
+            a.move(d, s0);
+            a.sse_frame(movsd, v, tmp_disp);
+            break;
+          case Opcode::cos: // cos(v), -sin(v) d
+            a.call(call_cos, v, num_live);
+            a.sse_frame(movsd_store, 0, tmp_disp);
+            a.reload(num_live);
+            a.call(call_sin, v, num_live);
+            a.move(s0, 0);
+            a.reload(num_live);
+            a.sse_constant(mulsd, s0, c_minus_one);
+            a.sse(mulsd, s0, d);
+            a.move(d, s0);
+            a.sse_frame(movsd, v, tmp_disp);
+            break;
+          case Opcode::tan: // t = tan(v), (1 + t t) d
+            a.call(call_tan, v, num_live);
+            a.move(s0, 0);
+            a.reload(num_live);
+            a.move(s1, s0);
+            a.sse(mulsd, s1, s0);
+            a.sse_constant(addsd, s1, c_one);
+            a.sse(mulsd, s1, d);
+            a.move(d, s1);
+            a.move(v, s0);
+            break;
+          case Opcode::square: // v v, d v + v d
+            a.move(s0, d);
+            a.sse(mulsd, s0, v);
+            a.move(s1, v);
+            a.sse(mulsd, s1, d);
+            a.sse(addsd, s0, s1);
+            a.move(d, s0);
+            a.sse(mulsd, v, v);
+            break;
+          case Opcode::root: // r = sqrt(v), d / (2 r)
+            a.sse(sqrtsd, s0, v);
+            a.sse_constant(movsd, s1, c_two);
+            a.sse(mulsd, s1, s0);
+            a.move(s2, d);
+            a.sse(divsd, s2, s1);
+            a.move(d, s2);
+            a.move(v, s0);
+            break;
+          case Opcode::log: // log(v), d / v
+            a.call(call_log, v, num_live);
+            a.move(s0, 0);
+            a.reload(num_live);
+            a.sse(divsd, d, v);
+            a.move(v, s0);
+            break;
+          case Opcode::halve: // q = v / 2, (d - q 0) / 2
+            a.move(s0, v);
+            a.sse_constant(divsd, s0, c_two);
+            a.move(s1, s0);
+            a.sse_constant(mulsd, s1, c_zero);
+            a.sse(subsd, d, s1);
+            a.sse_constant(divsd, d, c_two);
+            a.move(v, s0);
+            break;
+          case Opcode::add:
+            a.sse(addsd, va, v);
+            a.sse(addsd, da, d);
+            break;
+          case Opcode::subtract:
+            a.sse(subsd, va, v);
+            a.sse(subsd, da, d);
+            break;
+          case Opcode::multiply: // va v, da v + va d
+            a.move(s0, da);
+            a.sse(mulsd, s0, v);
+            a.move(s1, va);
+            a.sse(mulsd, s1, d);
+            a.sse(addsd, s0, s1);
+            a.move(da, s0);
+            a.sse(mulsd, va, v);
+            break;
+          case Opcode::divide: // q = va / v, (da - q d) / v
+            a.move(s0, va);
+            a.sse(divsd, s0, v);
+            a.move(s1, s0);
+            a.sse(mulsd, s1, d);
+            a.sse(subsd, da, s1);
+            a.sse(divsd, da, v);
+            a.move(va, s0);
+            break;
+          default:
+            assert(false);
+            return false;
+        }
+
+        if (arity(op) == 2) {
+          --depth;
+          v = va;
+          d = da;
+        }
+
+        // The same operators as checked by the interpreter
+        switch (op) {
+          case Opcode::invert: case Opcode::tan: case Opcode::square:
+          case Opcode::root: case Opcode::log:
+          case Opcode::add: case Opcode::subtract:
+          case Opcode::multiply: case Opcode::divide:
+            a.check(v);
+            a.check(d);
+            break;
+          default:
+            break;
+        }
+      }
+
+      assert(depth == 1);
+      return true;
+    }
+
+  } // namespace
+
+
+  void Jit::Unmap::operator()(uint8_t* buffer) const
+  {
+    munmap(buffer, buffer_size);
+  }
+
+
+  bool Jit::compile(BytecodeView code)
+  {
+    function = nullptr;
+
+    auto a = Assembler{};
+    a.emit({0x48, 0x81, 0xec}); // sub rsp, frame_size
+    a.emit32(frame_size);
+    a.sse_frame(movsd_store, 0, x_disp);
+    a.emit({0x48, 0x89, 0xbc, 0x24}); // mov [rsp + out_disp], rdi
+    a.emit32(out_disp);
+    a.sse_constant(movsd, acc, c_zero);
+
+    if (!emit_program(a, code)) {
+      return false;
+    }
+
+    a.emit({0x48, 0x8b, 0xbc, 0x24}); // mov rdi, [rsp + out_disp]
+    a.emit32(out_disp);
+    a.emit({0xf2, 0x0f, 0x11, 0x07});       // movsd [rdi], xmm0
+    a.emit({0xf2, 0x0f, 0x11, 0x4f, 0x08}); // movsd [rdi + 8], xmm1
+    a.emit({0x66, 0x45, 0x0f, 0x2e, 0xe4}); // ucomisd xmm12, xmm12
+    a.emit({0x0f, 0x9b, 0xc0});             // setnp al
+    a.emit({0x0f, 0xb6, 0xc0});             // movzx eax, al
+    a.emit({0x48, 0x81, 0xc4});             // add rsp, frame_size
+    a.emit32(frame_size);
+    a.emit(0xc3);                           // ret
+
+    if (code_offset + a.bytes.size() > buffer_size) {
+      return false;
+    }
+
+    if (!buffer) {
+      void* p = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) {
+        return false;
+      }
+      buffer.reset(static_cast<uint8_t*>(p));
+    } else if (mprotect(buffer.get(), buffer_size,
+                        PROT_READ | PROT_WRITE) != 0) {
+      return false;
+    }
+
+    std::memcpy(buffer.get(), constants, sizeof(constants));
+    std::memcpy(buffer.get() + code_offset, a.bytes.data(), a.bytes.size());
+    if (mprotect(buffer.get(), buffer_size, PROT_READ | PROT_EXEC) != 0) {
+      return false;
+    }
+
+    function = reinterpret_cast<Function>(buffer.get() + code_offset);
+    return true;
+  }
+
+
+  bool Jit::eval_batch_checked(std::span<const double> xs,
+                               std::span<Dual> ys) const
+  {
+    assert(function);
+    assert(xs.size() == ys.size());
+
+    for (std::size_t i = 0; i < xs.size(); ++i) {
+      if (!function(xs[i], &ys[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+#else
+
+  void Jit::Unmap::operator()(uint8_t*) const
+  { }
+
+  bool Jit::compile(BytecodeView)
+  {
+    return false;
+  }
+
+  bool Jit::eval_batch_checked(std::span<const double>, std::span<Dual>) const
+  {
+    assert(false);
+    return false;
+  }
+
+#endif
+
+} // namespace integrator
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "integrator.h"
+#include <span>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define INTEGRATOR_JIT 1
+#else
+#define INTEGRATOR_JIT 0
+#endif
+
+
+namespace integrator {
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Compiles a program to straight-line x86-64 code, which evaluates it on dual
+  // numbers with the operand stack held in SSE registers, and which computes
+  // bit for bit what Evaluator::eval_dual_checked does. Non-finite values are
+  // caught without branching, by summing v - v over the checked values into an
+  // accumulator, which ends up NaN if any of them wasn't finite.
+  //
+  // Compiling takes a couple of system calls to flip the protection of the
+  // code buffer, so it only pays off for programs evaluated at many points,
+  // typically the few candidates that survive the first verification stage.
+  // On other platforms, compile always fails, and callers fall back to the
+  // interpreter.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class Jit {
+  public:
+    static constexpr bool is_supported = INTEGRATOR_JIT;
+
+    // Deepest operand stack that fits in the registers
+    static constexpr std::size_t max_depth = 6;
+
+    // Compiles `code`, replacing the previously compiled program. Returns
+    // false if it can't, in which case nothing is compiled.
+    bool compile(BytecodeView code);
+
+    // Same as Evaluator::eval_batch_checked on dual numbers, with the compiled
+    // program.
+    bool eval_batch_checked(std::span<const double> xs,
+                            std::span<Dual> ys) const;
+
+  private:
+    using Function = bool(*)(double x, Dual* out);
+
+    struct Unmap {
+      void operator()(uint8_t* buffer) const;
+    };
+
+    std::unique_ptr<uint8_t, Unmap> buffer; // Mapped on the first compile
+    Function function = nullptr;
+  };
+
+} // namespace integrator
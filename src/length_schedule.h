@@ -0,0 +1,187 @@
+#pragma once
+
+#include "integrator.h"
+#include "rejection_cache.h"
+#include <array>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+
+namespace integrator {
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Chooses the number of draws of the random candidates of a worker, in
+  // place of the uniform draw of Composer::compose. The candidates come in
+  // blocks of one length, each timed as a whole, and every length keeps
+  // track of its candidates, of how many of those were new, and of their
+  // cost. A length is then chosen in proportion to its yield, new candidates
+  // per second, so that the mass drifts away from the lengths whose
+  // programs have all been seen, or are too slow to evaluate. The shortest
+  // lengths are soon spent, and for each of them, the longest length is
+  // raised by one, up to the most that fits in a Candidate.
+  //
+  // A candidate is new if it reached the verifiers, and was not seen among
+  // the recent ones of its length. Only one in sample_interval is looked up,
+  // in a small direct-mapped table per length, and the new ones among those
+  // stand for sample_interval each, which is enough to tell the lengths
+  // whose programs keep coming back.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class LengthSchedule {
+  public:
+    static constexpr int min_len = 2;
+    // Every draw but the first may add a binary operator.
+    static constexpr int max_max_len = (int{expr_max_size} + 1) / 2;
+
+    // Starts with the lengths of Composer::compose(tentative_len).
+    LengthSchedule(int tentative_len, uint32_t seed)
+      : rng{seed},
+      num_live(tentative_len)
+    {
+      assert(tentative_len >= 1 && tentative_len + 1 <= max_max_len);
+      lengths.resize(tentative_len);
+    }
+
+    // Number of draws of the next candidate
+    int next()
+    {
+      if (remaining == 0) {
+        end_block();
+        len = choose();
+        remaining = block_size;
+        block_start = clock::now();
+      }
+      --remaining;
+      return len;
+    }
+
+    // Takes note that the last candidate of next() made it to the
+    // verifiers, i.e. it was finite and not known to be wrong. The others
+    // are never new.
+    void verified(const Candidate& candidate)
+    {
+      if (++num_verified % sample_interval != 0) {
+        return;
+      }
+      auto hash = canonical_hash(candidate.bytecode());
+      auto& slot = lengths[len - min_len].recent[hash % table_size];
+      if (slot != hash) {
+        slot = hash;
+        ++block_new_sampled;
+      }
+    }
+
+    int max_len() const { return min_len + int(lengths.size()) - 1; }
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    // Candidates per block, enough for the clock to be cheap and precise
+    static constexpr unsigned int block_size = 64;
+    // Weights of the statistics of a length after each one of its blocks,
+    // so that they follow the saturation of the short lengths.
+    static constexpr double decay = 0.95;
+    // Share of the blocks spread evenly, not to write any length off.
+    static constexpr double exploration = 0.1;
+    // A length is spent once its share of new candidates is below that of
+    // the best one by this factor.
+    static constexpr double spent_ratio = 0.1;
+    static constexpr unsigned int sample_interval = 8;
+    static constexpr std::size_t table_size = 4096;
+
+    struct Length {
+      double num_tried = 0.0; // Decayed, like num_new and seconds
+      double num_new = 0.0;
+      double seconds = 0.0;
+      unsigned long num_blocks = 0;
+      std::vector<uint64_t> recent = std::vector<uint64_t>(table_size);
+    };
+
+    CustomGenerator rng;
+    std::vector<Length> lengths; // From min_len up
+    std::size_t num_live; // Lengths not spent, as asked for
+    int len = min_len;
+    unsigned int remaining = 0;
+    unsigned int block_new_sampled = 0;
+    unsigned long num_verified = 0;
+    clock::time_point block_start;
+
+    static double yield(const Length& length)
+    {
+      return length.seconds > 0.0 ? length.num_new / length.seconds : 0.0;
+    }
+
+    static double new_share(const Length& length)
+    {
+      return length.num_tried > 0.0 ? length.num_new / length.num_tried : 0.0;
+    }
+
+    void end_block()
+    {
+      if (block_start == clock::time_point{}) {
+        return;
+      }
+      std::chrono::duration<double> elapsed = clock::now() - block_start;
+      auto& length = lengths[len - min_len];
+      length.num_tried = decay * length.num_tried + block_size;
+      length.num_new = decay * length.num_new
+        + double(block_new_sampled * sample_interval);
+      length.seconds = decay * length.seconds + elapsed.count();
+      ++length.num_blocks;
+      block_new_sampled = 0;
+
+      // The spent lengths are the leading ones, whose programs are the
+      // fewest.
+      auto best = 0.0;
+      for (const auto& l : lengths) {
+        best = std::max(best, new_share(l));
+      }
+      auto num_spent = std::size_t{0};
+      while (num_spent < lengths.size()
+             && lengths[num_spent].num_blocks != 0
+             && new_share(lengths[num_spent]) < spent_ratio * best) {
+        ++num_spent;
+      }
+      if (lengths.size() < num_spent + num_live && max_len() < max_max_len) {
+        lengths.emplace_back();
+      }
+    }
+
+    int choose()
+    {
+      // Every length gets a block before its yield means anything.
+      auto untried = std::find_if(lengths.begin(), lengths.end(),
+                                  [](const Length& l) {
+                                    return l.num_blocks == 0;
+                                  });
+      if (untried != lengths.end()) {
+        return min_len + int(untried - lengths.begin());
+      }
+
+      auto n = lengths.size();
+      auto weights = std::array<double, max_max_len>{};
+      auto total = 0.0;
+      for (std::size_t i = 0; i < n; ++i) {
+        total += weights[i] = yield(lengths[i]);
+      }
+      auto even = total > 0.0 ? exploration * total / double(n) : 1.0;
+      total = 0.0;
+      for (std::size_t i = 0; i < n; ++i) {
+        total += weights[i] = (1.0 - exploration) * weights[i] + even;
+      }
+
+      auto u = total * (double(rng()) / 4294967296.0);
+      for (std::size_t i = 0; i + 1 < n; ++i) {
+        if (u < weights[i]) {
+          return min_len + int(i);
+        }
+        u -= weights[i];
+      }
+      return min_len + int(n) - 1;
+    }
+  };
+
+} // namespace integrator
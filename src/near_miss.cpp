@@ -0,0 +1,209 @@
+///////////////////////////////////////////////////////////////////////////////
+/////////////////////////      near_miss.cpp     //////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+//
+// The file is a header followed by records of 96 bytes, in the byte order of
+// the machine that wrote them:
+//
+//   header:  magic, size of a record
+//   record:  attempt, loss, integrand, seed, size, opcodes, padding
+//
+// The rings are single-producer single-consumer queues: the worker publishes
+// a record by a release store of the head, and the thread of the log frees
+// its slot by a release store of the tail once it is written.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "near_miss.h"
+#include "reverse.h"
+#include <atomic>
+#include <array>
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <fmt/format.h>
+
+
+namespace integrator {
+
+  namespace {
+
+    constexpr char magic[8] = {'I', 'N', 'T', 'G', 'N', 'M', 'L', '1'};
+
+    struct Header {
+      char magic[8];
+      uint32_t record_size;
+      uint32_t reserved;
+    };
+
+    struct Record {
+      uint64_t attempt;
+      double loss;
+      uint32_t integrand;
+      uint32_t seed;
+      uint8_t size;
+      std::array<Opcode, expr_max_size> code;
+      uint8_t padding[7];
+    };
+
+    static_assert(sizeof(Header) == 16 && sizeof(Record) == 96);
+
+  } // namespace
+
+
+  struct alignas(64) NearMissLog::Ring {
+    static constexpr uint64_t capacity = 1024; // A power of two
+
+    std::atomic<uint64_t> head{0}; // Records pushed, by the worker
+    alignas(64) std::atomic<uint64_t> tail{0}; // Records written, by the log
+    alignas(64) std::array<Record, capacity> records;
+  };
+
+
+  NearMissLog::NearMissLog(const std::string& path,
+                           unsigned int num_workers,
+                           std::chrono::milliseconds period)
+    : period{period}
+  {
+    file = std::fopen(path.c_str(), "ab");
+    if (!file) {
+      throw std::system_error(errno, std::generic_category(),
+                              fmt::format("fopen {}", path));
+    }
+    // Appending starts at the end of the file, so only a new one is empty.
+    std::fseek(file, 0, SEEK_END);
+    if (std::ftell(file) == 0) {
+      auto header = Header{};
+      std::memcpy(header.magic, magic, sizeof(magic));
+      header.record_size = sizeof(Record);
+      std::fwrite(&header, sizeof(header), 1, file);
+    }
+
+    for (auto id = 0u; id < num_workers; ++id) {
+      rings.push_back(std::make_unique<Ring>());
+    }
+    thread = std::thread(&NearMissLog::run, this);
+  }
+
+
+  NearMissLog::~NearMissLog()
+  {
+    {
+      auto lk = std::scoped_lock{mtx};
+      stopping = true;
+    }
+    stop_requested.notify_all();
+    thread.join();
+    std::fclose(file);
+  }
+
+
+  bool NearMissLog::record(unsigned int id,
+                           const Candidate& candidate,
+                           double loss,
+                           uint32_t integrand,
+                           uint32_t seed,
+                           uint64_t attempt)
+  {
+    auto& ring = *rings[id];
+    auto head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) == Ring::capacity) {
+      return false;
+    }
+
+    auto& record = ring.records[head % Ring::capacity];
+    record = Record{};
+    record.attempt = attempt;
+    record.loss = loss;
+    record.integrand = integrand;
+    record.seed = seed;
+    record.size = static_cast<uint8_t>(candidate.size);
+    std::copy_n(candidate.code.begin(), candidate.size, record.code.begin());
+    ring.head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+
+  void NearMissLog::run()
+  {
+    auto lk = std::unique_lock{mtx};
+    while (!stop_requested.wait_for(lk, period, [this] { return stopping; })) {
+      lk.unlock();
+      drain();
+      lk.lock();
+    }
+    lk.unlock();
+    drain();
+  }
+
+
+  void NearMissLog::drain()
+  {
+    for (auto& ring : rings) {
+      auto tail = ring->tail.load(std::memory_order_relaxed);
+      auto head = ring->head.load(std::memory_order_acquire);
+      // At most two runs, before and after the end of the ring
+      while (tail != head) {
+        auto begin = tail % Ring::capacity;
+        auto n = std::min(head - tail, Ring::capacity - begin);
+        std::fwrite(&ring->records[begin], sizeof(Record), n, file);
+        tail += n;
+      }
+      ring->tail.store(tail, std::memory_order_release);
+    }
+    std::fflush(file);
+  }
+
+
+  std::vector<NearMiss> read_near_misses(const std::string& path)
+  {
+    auto file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+      throw std::system_error(errno, std::generic_category(),
+                              fmt::format("fopen {}", path));
+    }
+    auto closer = std::unique_ptr<std::FILE, int (*)(std::FILE*)>(
+        file, &std::fclose);
+
+    auto fail = [&path] {
+      return std::runtime_error(fmt::format(
+          "{} is not a log of near misses", path));
+    };
+
+    auto header = Header{};
+    if (std::fread(&header, sizeof(header), 1, file) != 1
+        || std::memcmp(header.magic, magic, sizeof(magic)) != 0
+        || header.record_size != sizeof(Record)) {
+      throw fail();
+    }
+
+    auto ret = std::vector<NearMiss>{};
+    auto converter = InfixConverter{};
+    auto record = Record{};
+    auto candidate = Candidate{};
+    while (std::fread(&record, sizeof(record), 1, file) == 1) {
+      if (record.size == 0 || record.size > expr_max_size
+          || std::any_of(record.code.begin(),
+                         record.code.begin() + record.size,
+                         [](Opcode op) { return op >= Opcode::end; })) {
+        throw fail();
+      }
+      candidate.size = record.size;
+      std::copy_n(record.code.begin(), record.size, candidate.code.begin());
+      candidate.code[record.size] = Opcode::end;
+
+      auto& near_miss = ret.emplace_back();
+      near_miss.expr = candidate.to_string();
+      converter.convert(near_miss.expr, near_miss.infix);
+      near_miss.loss = record.loss;
+      near_miss.integrand = record.integrand;
+      near_miss.seed = record.seed;
+      near_miss.attempt = record.attempt;
+    }
+    return ret;
+  }
+
+} // namespace integrator
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "integrator.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+
+
+namespace integrator {
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Appends the candidates that came close to an integrand to a binary file,
+  // one fixed-width record each. Every worker pushes its records to a ring of
+  // its own, with no lock and no system call, and a thread of the log drains
+  // the rings to the file periodically. A worker whose ring is full drops the
+  // record rather than wait.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class NearMissLog {
+  public:
+    // Opens the file at `path` for appending, and writes its header if it is
+    // new. Throws std::system_error if it can't be opened.
+    NearMissLog(const std::string& path,
+                unsigned int num_workers,
+                std::chrono::milliseconds period = std::chrono::milliseconds(100));
+
+    // Drains the rings one last time, and closes the file.
+    ~NearMissLog();
+
+    NearMissLog(const NearMissLog&) = delete;
+    NearMissLog& operator=(const NearMissLog&) = delete;
+
+    // Called by worker `id` only. `seed` is that of the worker's random stream,
+    // and `attempt` the number of attempts it had made in the job. Returns
+    // false if the record was dropped.
+    bool record(unsigned int id,
+                const Candidate& candidate,
+                double loss,
+                uint32_t integrand,
+                uint32_t seed,
+                uint64_t attempt);
+
+  private:
+    struct Ring;
+
+    std::FILE* file = nullptr;
+    std::vector<std::unique_ptr<Ring>> rings; // Per worker
+    std::chrono::milliseconds period;
+
+    std::mutex mtx;
+    std::condition_variable stop_requested;
+    bool stopping = false; // Guarded by mtx
+    std::thread thread;
+
+    void run();
+    void drain();
+  };
+
+
+  // A record of a NearMissLog, as read back
+  struct NearMiss {
+    std::string expr;  // In RPN
+    std::string infix; // Likewise, as by infix_from_reverse_polish
+    double loss = 0.0;
+    uint32_t integrand = 0; // Index in the job
+    uint32_t seed = 0;
+    uint64_t attempt = 0;
+  };
+
+  // The records of the file at `path`, in the order they were written. Throws
+  // std::system_error if it can't be read, and std::runtime_error if it is
+  // not a log of near misses. A record cut short at the end is left out.
+  std::vector<NearMiss> read_near_misses(const std::string& path);
+
+} // namespace integrator
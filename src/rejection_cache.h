@@ -0,0 +1,110 @@
+#pragma once
+
+#include "integrator.h"
+#include <array>
+#include <vector>
+#include <atomic>
+#include <utility>
+#include <cstdint>
+
+
+namespace integrator {
+
+  // Hashes an expression up to rewrites that leave its value bit for bit
+  // unchanged, so that e.g. `x~~` and `x`, or `x1+` and `1x+`, share a hash.
+  // Namely, double sign inversions cancel out, and the operands of the
+  // commutative operators are ordered by hash. Never returns 0.
+  inline uint64_t canonical_hash(BytecodeView code)
+  {
+    struct Node {
+      uint64_t hash;
+      Opcode op;
+      std::size_t child; // Index of the operand of a unary operator
+    };
+
+    std::array<Node, expr_max_size> nodes; // One per opcode, in RPN order
+    std::array<std::size_t, expr_max_size> stack; // Indices into nodes
+    std::size_t num_nodes = 0;
+    std::size_t top = 0;
+
+    for (auto op : code) {
+      auto tag = static_cast<uint64_t>(op) + 1;
+
+      switch (arity(op)) {
+        case 0:
+          if (op == Opcode::end) {
+            break;
+          }
+          nodes[num_nodes] = {mix64(tag), op, 0};
+          stack[top++] = num_nodes++;
+          break;
+
+        case 1: {
+          const auto& arg = nodes[stack[top-1]];
+          if (op == Opcode::invert_sign && arg.op == Opcode::invert_sign) {
+            stack[top-1] = arg.child;
+            break;
+          }
+          nodes[num_nodes] = {mix64(arg.hash * 0x9e3779b97f4a7c15 + tag),
+                              op, stack[top-1]};
+          stack[top-1] = num_nodes++;
+          break;
+        }
+
+        case 2: {
+          auto lhs = nodes[stack[top-2]].hash;
+          auto rhs = nodes[stack[top-1]].hash;
+          if ((op == Opcode::add || op == Opcode::multiply) && rhs < lhs) {
+            std::swap(lhs, rhs);
+          }
+          auto hash = mix64(mix64(lhs * 0x9e3779b97f4a7c15 + tag) ^ rhs);
+          --top;
+          nodes[num_nodes] = {hash, op, 0};
+          stack[top-1] = num_nodes++;
+          break;
+        }
+      }
+    }
+
+    assert(top == 1);
+    auto ret = nodes[stack[0]].hash;
+    return ret != 0 ? ret : 1;
+  }
+
+
+  //////////////////////////////////////////////////////////////////////////////
+  // A bounded set of the canonical hashes of short candidates known to be
+  // wrong, shared by all the workers of a job. Short expressions come up
+  // again and again, and are then skipped without being evaluated.
+  //
+  // Each hash has a single slot, where it overwrites whatever was there: the
+  // set only ever forgets, and a false hit takes two 64-bit hashes colliding.
+  // Slots are relaxed atomics, so lookups and insertions never wait.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class RejectionCache {
+  public:
+    // Longer candidates are too unlikely to come up again to be worth it.
+    static constexpr std::size_t max_candidate_size = 6;
+
+    explicit RejectionCache(unsigned int log2_num_slots = 16)
+      : slots(std::size_t{1} << log2_num_slots),
+      mask{slots.size() - 1}
+    { }
+
+    bool contains(uint64_t hash) const
+    {
+      return slots[hash & mask].load(std::memory_order_relaxed) == hash;
+    }
+
+    void insert(uint64_t hash)
+    {
+      slots[hash & mask].store(hash, std::memory_order_relaxed);
+    }
+
+  private:
+    std::vector<std::atomic<uint64_t>> slots; // 0 marks an empty slot
+    std::size_t mask;
+  };
+
+} // namespace integrator
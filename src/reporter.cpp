@@ -0,0 +1,260 @@
+///////////////////////////////////////////////////////////////////////////////
+/////////////////////////      reporter.cpp      //////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+//
+// The reporter thread and its sinks. A sink is called on the reporter thread
+// only, one report after the other, so that it needs no locking of its own.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "reporter.h"
+#include <memory>
+#include <system_error>
+#include <utility>
+#include <cstdio>
+#include <cerrno>
+#include <fmt/format.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+namespace integrator {
+
+  Reporter::Reporter(std::function<SearchStats()> sample,
+                     unsigned long max_attempts,
+                     Sink sink,
+                     std::chrono::milliseconds period)
+    : sample{std::move(sample)},
+    max_attempts{max_attempts},
+    sink{std::move(sink)},
+    period{period}
+  {
+    thread = std::thread(&Reporter::run, this);
+  }
+
+
+  Reporter::~Reporter()
+  {
+    {
+      auto lk = std::scoped_lock{mtx};
+      stopping = true;
+    }
+    stop_requested.notify_all();
+    thread.join();
+  }
+
+
+  void Reporter::run()
+  {
+    auto lk = std::unique_lock{mtx};
+    while (!stop_requested.wait_for(lk, period, [this] { return stopping; })) {
+      lk.unlock();
+      report();
+      lk.lock();
+    }
+    lk.unlock();
+    report();
+  }
+
+
+  void Reporter::report()
+  {
+    auto progress = Progress{};
+    progress.stats = sample();
+
+    auto now = Clock::now();
+    auto seconds = [](Clock::duration d) {
+      return std::chrono::duration<double>(d).count();
+    };
+    progress.elapsed = seconds(now - start);
+    auto interval = seconds(now - last_time);
+    auto attempts = progress.stats.num_attempts;
+    auto made = attempts - progress.stats.num_resumed_attempts;
+    if (interval > 0.0 && made >= last_attempts) {
+      progress.rate = (made - last_attempts) / interval;
+    }
+    if (max_attempts != 0 && progress.rate > 0.0) {
+      progress.eta = attempts < max_attempts
+        ? (max_attempts - attempts) / progress.rate
+        : 0.0;
+    }
+    last_time = now;
+    last_attempts = made;
+
+    sink(progress);
+  }
+
+
+  namespace {
+
+    // Of the attempts
+    double percentage(unsigned long n, const SearchStats& stats)
+    {
+      return stats.num_attempts == 0 ? 0.0 : 100.0 * n / stats.num_attempts;
+    }
+
+    double mean_size(const SearchStats& stats)
+    {
+      auto sum = 0.0;
+      for (std::size_t size = 0; size < stats.num_by_size.size(); ++size) {
+        sum += static_cast<double>(size) * stats.num_by_size[size];
+      }
+      return stats.num_attempts == 0 ? 0.0 : sum / stats.num_attempts;
+    }
+
+  } // namespace
+
+
+  Reporter::Sink print_progress(std::FILE* out)
+  {
+    return [out](const Progress& progress) {
+      const auto& stats = progress.stats;
+      auto eta = progress.eta ? fmt::format("{:.0f}s", *progress.eta)
+                              : std::string("-");
+      fmt::print(out,
+                 "[{:.1f}s] {} attempts, {:.3g}/s, ETA {}, size {:.1f}: "
+                 "{:.1f}% skipped, {:.1f}% non-finite, {:.1f}% rejected at "
+                 "the first point, {} verified\n",
+                 progress.elapsed, stats.num_attempts, progress.rate, eta,
+                 mean_size(stats),
+                 percentage(stats.num_skipped, stats),
+                 percentage(stats.num_non_finite, stats),
+                 percentage(stats.num_first_point_rejections, stats),
+                 stats.num_verifications);
+      std::fflush(out);
+    };
+  }
+
+
+  Reporter::Sink write_prometheus(std::string path)
+  {
+    return [path = std::move(path)](const Progress& progress) {
+      const auto& stats = progress.stats;
+      auto text = std::string{};
+      auto counter = [&text](const char* name, const char* help,
+                             unsigned long value) {
+        text += fmt::format("# HELP integrator_{0} {1}\n"
+                            "# TYPE integrator_{0} counter\n"
+                            "integrator_{0} {2}\n", name, help, value);
+      };
+      counter("attempts_total", "Candidates tried", stats.num_attempts);
+      counter("skipped_total", "Candidates known to be wrong",
+              stats.num_skipped);
+      counter("non_finite_total", "Candidates not finite at the first x",
+              stats.num_non_finite);
+      counter("first_point_rejections_total",
+              "Candidates near no integrand at the first x",
+              stats.num_first_point_rejections);
+      counter("verifications_total", "Candidates verified, per integrand",
+              stats.num_verifications);
+
+      text += "# HELP integrator_attempts_by_size_total Candidates tried, "
+              "by size\n"
+              "# TYPE integrator_attempts_by_size_total counter\n";
+      for (std::size_t size = 0; size < stats.num_by_size.size(); ++size) {
+        if (stats.num_by_size[size] != 0) {
+          text += fmt::format(
+              "integrator_attempts_by_size_total{{size=\"{}\"}} {}\n",
+              size, stats.num_by_size[size]);
+        }
+      }
+
+      text += fmt::format("# HELP integrator_attempts_per_second Rate since "
+                          "the last report\n"
+                          "# TYPE integrator_attempts_per_second gauge\n"
+                          "integrator_attempts_per_second {}\n",
+                          progress.rate);
+      if (progress.eta) {
+        text += fmt::format("# HELP integrator_eta_seconds Until the attempts "
+                            "run out\n"
+                            "# TYPE integrator_eta_seconds gauge\n"
+                            "integrator_eta_seconds {}\n", *progress.eta);
+      }
+
+      // The collector must never see a partial file.
+      auto temporary = path + ".tmp";
+      if (auto file = std::fopen(temporary.c_str(), "w")) {
+        std::fputs(text.c_str(), file);
+        std::fclose(file);
+        std::rename(temporary.c_str(), path.c_str());
+      }
+    };
+  }
+
+
+  namespace {
+
+    // A connected UDP socket, shared by the copies of a sink
+    class Datagrams {
+    public:
+      Datagrams(const std::string& host, uint16_t port)
+      {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* addresses = nullptr;
+        auto service = std::to_string(port);
+        if (::getaddrinfo(host.c_str(), service.c_str(), &hints,
+                          &addresses) != 0) {
+          throw std::system_error(EHOSTUNREACH, std::generic_category(),
+                                  "getaddrinfo");
+        }
+        for (auto a = addresses; a && fd == -1; a = a->ai_next) {
+          fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+          if (fd != -1 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+          }
+        }
+        ::freeaddrinfo(addresses);
+        if (fd == -1) {
+          throw std::system_error(errno, std::generic_category(), "connect");
+        }
+      }
+
+      ~Datagrams() { ::close(fd); }
+
+      Datagrams(const Datagrams&) = delete;
+      Datagrams& operator=(const Datagrams&) = delete;
+
+      // Lost datagrams are lost stats, which statsd is designed to live with.
+      void send(const std::string& payload)
+      {
+        (void)::send(fd, payload.data(), payload.size(), 0);
+      }
+
+    private:
+      int fd = -1;
+    };
+
+  } // namespace
+
+
+  Reporter::Sink send_statsd(const std::string& host,
+                             uint16_t port,
+                             std::string prefix)
+  {
+    auto socket = std::make_shared<Datagrams>(host, port);
+    return [socket, prefix = std::move(prefix)](const Progress& progress) {
+      const auto& stats = progress.stats;
+      auto payload = std::string{};
+      auto gauge = [&](const char* name, auto value) {
+        payload += fmt::format("{}.{}:{}|g\n", prefix, name, value);
+      };
+      gauge("attempts", stats.num_attempts);
+      gauge("skipped", stats.num_skipped);
+      gauge("non_finite", stats.num_non_finite);
+      gauge("first_point_rejections", stats.num_first_point_rejections);
+      gauge("verifications", stats.num_verifications);
+      gauge("attempts_per_second", progress.rate);
+      gauge("mean_size", mean_size(stats));
+      if (progress.eta) {
+        gauge("eta_seconds", *progress.eta);
+      }
+      socket->send(payload);
+    };
+  }
+
+} // namespace integrator
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "search.h"
+#include <functional>
+#include <optional>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+
+
+namespace integrator {
+
+  // A look at a running search, as handed to the sinks of a Reporter
+  struct Progress {
+    SearchStats stats;
+    double elapsed = 0.0;      // Seconds since the reporter started
+    double rate = 0.0;         // Attempts per second, since the last report
+    std::optional<double> eta; // Seconds left until max_attempts, if any
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Samples the stats of a search periodically, on a thread of its own, and
+  // hands its progress over to a sink. The stats are read with relaxed loads
+  // of the counters that each worker keeps on its own cache lines, so that
+  // the workers neither wait for the reporter nor share a line with it.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class Reporter {
+  public:
+    using Sink = std::function<void(const Progress&)>;
+
+    // max_attempts = 0 means no limit, and no ETA.
+    Reporter(std::function<SearchStats()> sample,
+             unsigned long max_attempts,
+             Sink sink,
+             std::chrono::milliseconds period = std::chrono::seconds(1));
+
+    // Reports one last time, and stops.
+    ~Reporter();
+
+    Reporter(const Reporter&) = delete;
+    Reporter& operator=(const Reporter&) = delete;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    std::function<SearchStats()> sample;
+    unsigned long max_attempts;
+    Sink sink;
+    std::chrono::milliseconds period;
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point last_time = start;
+    // Made since the job was resumed, if it was, so that the rate leaves out
+    // the attempts of the checkpoint
+    unsigned long last_attempts = 0;
+
+    std::mutex mtx;
+    std::condition_variable stop_requested;
+    bool stopping = false; // Guarded by mtx
+    std::thread thread;
+
+    void run();
+    void report();
+  };
+
+
+  // A line per report, with the rate, the ETA, and the share of candidates
+  // that each stage rejects.
+  Reporter::Sink print_progress(std::FILE* out = stderr);
+
+  // The Prometheus text format, written over the file at `path` through a
+  // rename, e.g. for the textfile collector of node_exporter.
+  Reporter::Sink write_prometheus(std::string path);
+
+  // Gauges sent to a statsd daemon over UDP, named `prefix`.<stat>. Throws
+  // std::system_error if the host can't be resolved.
+  Reporter::Sink send_statsd(const std::string& host,
+                             uint16_t port,
+                             std::string prefix = "integrator");
+
+} // namespace integrator
@@ -8,35 +8,53 @@
 // few simplifications on it, before it finally converts this AST into
 // infix notation.
 //
+// The nodes of the tree live in a flat arena, tagged with their kind, and
+// refer to their operands by index. As the program is read in RPN, the
+// operands of a node are always built, and simplified, before the node is, so
+// that the tree is simplified in the same single pass that builds it.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
 
-#include <utility>
-#include <stack>
+#include "reverse.h"
+#include <vector>
+#include <optional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <system_error>
+#include <iterator>
+#include <limits>
 #include <cassert>
-#include <iostream>
-#include <string>
-#include <cmath>
+#include <cstdint>
+#include <cerrno>
 #include <fmt/format.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
-class AST {
-public:
-  virtual std::string to_string() = 0;
-  virtual ~AST() { }
-};
-
+namespace {
 
-struct Operator {
-  const char symbol;
-  const int precedence;
+  enum class Kind : uint8_t {
+    variable, // symbol is its name
+    integer,  // value
+    function, // symbol is that of the function, lhs its argument
+    binary,   // symbol is that of the operator
+    negative, // lhs is the negated expression
+  };
 
-  Operator(char symbol) : symbol{symbol}, precedence{eval_precedence(symbol)}
-  { }
+  struct Node {
+    Kind kind;
+    char symbol = 0;
+    int value = 0;
+    uint32_t lhs = 0, rhs = 0; // Indices of the operands
+  };
 
 
-private:
-  static int eval_precedence(char symbol)
+  int precedence_of(char symbol)
   {
     switch (symbol) {
       case '+':
@@ -50,58 +68,10 @@ private:
     }
 
     assert(false && "Undefined operator symbol");
+    return 0;
   }
-};
-
-
-class VariableAST : public AST {
-  std::string name;
-
-public:
-  VariableAST(std::string name) : name{std::move(name)}
-  { }
-
-  std::string to_string() override
-  {
-    return name;
-  }
-};
-
-class IntAST : public AST {
-  int value;
-
-public:
-  IntAST(int value) : value{value}
-  { }
-
-  std::string to_string() override
-  {
-    return std::to_string(value);
-  }
-
-  auto get_value() { return value; }
-};
 
-
-class FuncAST : public AST {
-  std::string func_name;
-  std::unique_ptr<AST> argument;
-
-public:
-  FuncAST(char func_symbol, std::unique_ptr<AST> argument)
-    : func_name{eval_func_name(func_symbol)},
-    argument{std::move(argument)}
-  { }
-
-  std::string to_string() override
-  {
-    return fmt::format("{}({})", func_name, argument->to_string());
-  }
-
-  auto& get_argument() { return argument; }
-
-private:
-  static std::string eval_func_name(char symbol)
+  const char* function_name_of(char symbol)
   {
     switch (symbol) {
       case 'S':
@@ -116,297 +86,471 @@ private:
         return "log";
     }
     assert(false && "Undefined function symbol");
+    return "";
   }
-};
 
+  // The value of an operator acting on integers, if it is an integer that
+  // fits in an int
+  std::optional<int> fold(char symbol, int a, int b)
+  {
+    auto wide_a = static_cast<long long>(a);
+    auto wide_b = static_cast<long long>(b);
+    auto ret = 0ll;
+    switch (symbol) {
+      case '+': ret = wide_a + wide_b; break;
+      case '-': ret = wide_a - wide_b; break;
+      case '*': ret = wide_a * wide_b; break;
+      case '^': // Only ever squares
+        if (b != 2) {
+          return std::nullopt;
+        }
+        ret = wide_a * wide_a;
+        break;
+      case '/':
+        if (b == 0 || wide_a % wide_b != 0) {
+          return std::nullopt;
+        }
+        ret = wide_a / wide_b;
+        break;
+    }
+    if (ret < std::numeric_limits<int>::min()
+        || ret > std::numeric_limits<int>::max()) {
+      return std::nullopt;
+    }
+    return static_cast<int>(ret);
+  }
 
-class BinaryOperatorAST : public AST {
-  Operator op;
-  std::unique_ptr<AST> lhs, rhs;
+} // namespace
 
-public:
-  BinaryOperatorAST(Operator op,
-                    std::unique_ptr<AST> lhs,
-                    std::unique_ptr<AST> rhs)
-    : op{op}, lhs{std::move(lhs)}, rhs{std::move(rhs)}
-  { }
 
-  std::string to_string() override
-  {
-    auto lhs_str = lhs->to_string();
-    auto rhs_str = rhs->to_string();
+namespace detail {
 
-    if (auto p = dynamic_cast<BinaryOperatorAST*>(lhs.get())) {
-      if (p->op.precedence < op.precedence) {
-        lhs_str = fmt::format("({})", std::move(lhs_str));
+  // Parses, simplifies and prints expressions, reusing its arena from one to
+  // the next.
+  class Converter {
+  public:
+    void convert(std::string_view src, std::string& out)
+    {
+      nodes.clear();
+      stack.clear();
+      for (char c : src) {
+        push(c);
       }
+      assert(stack.size() == 1);
+      write(stack.back(), out);
     }
 
-    if (auto p = dynamic_cast<BinaryOperatorAST*>(rhs.get())) {
-      if (p->op.precedence < op.precedence) {
-        rhs_str = fmt::format("({})", std::move(rhs_str));
+  private:
+    std::vector<Node> nodes;
+    std::vector<uint32_t> stack; // Indices of the nodes read but not used
+
+    const Node& at(uint32_t i) const { return nodes[i]; }
+
+    bool is_integer(uint32_t i, int value) const
+    {
+      return at(i).kind == Kind::integer && at(i).value == value;
+    }
+
+    uint32_t add(Node node)
+    {
+      nodes.push_back(node);
+      return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    uint32_t pop()
+    {
+      auto ret = stack.back();
+      stack.pop_back();
+      return ret;
+    }
+
+    uint32_t integer(int value)
+    {
+      return add({Kind::integer, 0, value});
+    }
+
+    // Minus Int = another Int
+    // Minus Minus Something = Something
+    uint32_t negative(uint32_t operand)
+    {
+      if (at(operand).kind == Kind::integer
+          && at(operand).value != std::numeric_limits<int>::min()) {
+        return integer(-at(operand).value);
       }
+      if (at(operand).kind == Kind::negative) {
+        return at(operand).lhs;
+      }
+      return add({Kind::negative, 0, 0, operand});
     }
 
-    // Division and subtraction aren't associative.
-    if (op.symbol == '/' || op.symbol == '-') {
-      if (auto p = dynamic_cast<BinaryOperatorAST*>(rhs.get())) {
-        if (p->op.symbol == op.symbol) {
-          rhs_str = fmt::format("({})", std::move(rhs_str));
+    uint32_t binary(char symbol, uint32_t lhs, uint32_t rhs)
+    {
+      // Evaluate operators acting on integers (only if result is an integer)
+      if (at(lhs).kind == Kind::integer && at(rhs).kind == Kind::integer) {
+        if (auto value = fold(symbol, at(lhs).value, at(rhs).value)) {
+          return integer(*value);
         }
       }
-    }
 
-    return fmt::format("{} {} {}", lhs_str, op.symbol, rhs_str);
-  }
+      // The integer 1 is the identity of multiplication, and a right
+      // identity of division and powers.
+      if (symbol == '*' && is_integer(lhs, 1)) {
+        return rhs;
+      }
+      if ((symbol == '*' || symbol == '/' || symbol == '^')
+          && is_integer(rhs, 1)) {
+        return lhs;
+      }
 
-  auto& get_lhs() { return lhs; }
-  auto& get_rhs() { return rhs; }
-  auto get_operator_symbol() { return op.symbol; }
-};
+      return add({Kind::binary, symbol, 0, lhs, rhs});
+    }
 
+    void push(char c)
+    {
+      switch (c) {
+        case '0':
+          stack.push_back(integer(0));
+          break;
+        case '1':
+          stack.push_back(integer(1));
+          break;
+        case 'x':
+        case 'y':
+        case 'z':
+        case 'a':
+        case 'b':
+        case 'c':
+          stack.push_back(add({Kind::variable, c}));
+          break;
+
+        case 'S':
+        case 'C':
+        case 'T':
+        case 'R':
+        case 'L':
+          stack.push_back(add({Kind::function, c, 0, pop()}));
+          break;
+
+        case '+':
+        case '-':
+        case '*':
+        case '/': {
+          auto rhs = pop();
+          auto lhs = pop();
+          stack.push_back(binary(c, lhs, rhs));
+          break;
+        }
+        case '\\': {
+          auto rhs = pop();
+          stack.push_back(binary('/', integer(1), rhs));
+          break;
+        }
+        case 'H':
+          stack.push_back(binary('/', pop(), integer(2)));
+          break;
+        case '<':
+          stack.push_back(binary('-', pop(), integer(1)));
+          break;
+        case '>':
+          stack.push_back(binary('+', pop(), integer(1)));
+          break;
+        case '2':
+          stack.push_back(binary('^', pop(), integer(2)));
+          break;
+        case '~':
+          stack.push_back(negative(pop()));
+          break;
+        default:
+          assert(false);
+          break;
+      }
+    }
 
-class NegativeOperatorAST : public AST {
-  std::unique_ptr<AST> rhs;
+    // Whether an operand of a binary operator needs parentheses
+    bool needs_parentheses(char symbol, uint32_t operand, bool is_rhs) const
+    {
+      const auto& node = at(operand);
+      auto precedence = precedence_of(symbol);
+      if (node.kind == Kind::binary) {
+        auto operand_precedence = precedence_of(node.symbol);
+        if (operand_precedence < precedence) {
+          return true;
+        }
+        // Division and subtraction aren't associative, and powers group to
+        // the right.
+        if (operand_precedence == precedence) {
+          return is_rhs ? symbol == '/' || symbol == '-' : symbol == '^';
+        }
+        return false;
+      }
+      // -x ^ 2 would read as -(x ^ 2).
+      return symbol == '^' && !is_rhs
+        && (node.kind == Kind::negative
+            || (node.kind == Kind::integer && node.value < 0));
+    }
 
-public:
-  NegativeOperatorAST(std::unique_ptr<AST> rhs)
-    : rhs{std::move(rhs)}
-  { }
+    void write_operand(char symbol, uint32_t operand, bool is_rhs,
+                       std::string& out) const
+    {
+      if (needs_parentheses(symbol, operand, is_rhs)) {
+        out += '(';
+        write(operand, out);
+        out += ')';
+      } else {
+        write(operand, out);
+      }
+    }
 
-  std::string to_string() override
-  {
-    if (dynamic_cast<BinaryOperatorAST*>(rhs.get())) {
-      return fmt::format("-({})", rhs->to_string());
+    void write(uint32_t i, std::string& out) const
+    {
+      const auto& node = at(i);
+      switch (node.kind) {
+        case Kind::variable:
+          out += node.symbol;
+          break;
+        case Kind::integer:
+          fmt::format_to(std::back_inserter(out), "{}", node.value);
+          break;
+        case Kind::function:
+          out += function_name_of(node.symbol);
+          out += '(';
+          write(node.lhs, out);
+          out += ')';
+          break;
+        case Kind::binary:
+          write_operand(node.symbol, node.lhs, false, out);
+          out += ' ';
+          out += node.symbol;
+          out += ' ';
+          write_operand(node.symbol, node.rhs, true, out);
+          break;
+        case Kind::negative:
+          out += '-';
+          if (at(node.lhs).kind == Kind::binary) {
+            out += '(';
+            write(node.lhs, out);
+            out += ')';
+          } else {
+            write(node.lhs, out);
+          }
+          break;
+      }
     }
-    return fmt::format("-{}", rhs->to_string());
-  }
+  };
 
-  auto& get_rhs() { return rhs; }
-};
+} // namespace detail
 
 
-static std::unique_ptr<AST> parse_reverse_polish(std::string_view src)
+std::string infix_from_reverse_polish(std::string_view src)
 {
-  auto stack = std::stack<std::unique_ptr<AST>>{};
+  auto converter = detail::Converter{};
+  auto ret = std::string{};
+  converter.convert(src, ret);
+  return ret;
+}
 
-  for (; !src.empty(); src = src.substr(1)) {
-    switch (src.front()) {
-      case '0':
-        stack.push(std::make_unique<IntAST>(0));
-        break;
-      case '1':
-        stack.push(std::make_unique<IntAST>(1));
-        break;
-      case 'x':
-      case 'y':
-      case 'z':
-      case 'a':
-      case 'b':
-      case 'c':
-        stack.push(std::make_unique<VariableAST>(std::string(1, src.front())));
-        break;
 
-      case 'S':
-      case 'C':
-      case 'T':
-      case 'R':
-      case 'L': {
-        auto arg = std::unique_ptr(std::move(stack.top()));
-        stack.pop();
+InfixConverter::InfixConverter()
+  : converter{std::make_unique<detail::Converter>()}
+{ }
 
-        stack.push(std::make_unique<FuncAST>(std::move(src.front()),
-                                             std::move(arg)));
-        break;
-      }
+InfixConverter::~InfixConverter() = default;
+InfixConverter::InfixConverter(InfixConverter&&) noexcept = default;
+InfixConverter& InfixConverter::operator=(InfixConverter&&) noexcept = default;
 
-      case '+':
-      case '-':
-      case '*':
-      case '/': {
-        auto rhs = std::unique_ptr(std::move(stack.top()));
-        stack.pop();
-        auto lhs = std::unique_ptr(std::move(stack.top()));
-        stack.pop();
-        auto op = Operator(src.front());
-        stack.push(std::make_unique<BinaryOperatorAST>(op,
-                                                       std::move(lhs),
-                                                       std::move(rhs)));
-        break;
-      }
-      case '\\': {
-        auto lhs = std::make_unique<IntAST>(1);
-        auto rhs = std::unique_ptr(std::move(stack.top()));
-        stack.pop();
-        stack.push(std::make_unique<BinaryOperatorAST>('/',
-                                                       std::move(lhs),
-                                                       std::move(rhs)));
-        break;
-      }
-      case 'H': {
-        auto lhs = std::unique_ptr(std::move(stack.top()));
-        stack.pop();
-        auto rhs = std::make_unique<IntAST>(2);
-        stack.push(std::make_unique<BinaryOperatorAST>('/',
-                                                       std::move(lhs),
-                                                       std::move(rhs)));
-        break;
+void InfixConverter::convert(std::string_view src, std::string& out)
+{
+  converter->convert(src, out);
+}
+
+
+namespace {
+
+  // Lines handed over to a thread at once, and to the sink
+  constexpr std::size_t chunk_size = 1 << 20; // Bytes, rounded up to a line
+
+  // Most chunks converted but not yet handed over, per thread
+  constexpr std::size_t max_ahead = 4;
+
+  void convert_lines(detail::Converter& converter, std::string_view src,
+                     std::string& out)
+  {
+    while (!src.empty()) {
+      auto end = src.find('\n');
+      auto line = src.substr(0, end);
+      if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
       }
-      case '<': {
-        auto lhs = std::unique_ptr(std::move(stack.top()));
-        stack.pop();
-        auto rhs = std::make_unique<IntAST>(1);
-        stack.push(std::make_unique<BinaryOperatorAST>('-',
-                                                       std::move(lhs),
-                                                       std::move(rhs)));
-        break;
+      if (!line.empty()) {
+        converter.convert(line, out);
       }
-      case '>': {
-        auto lhs = std::unique_ptr(std::move(stack.top()));
-        stack.pop();
-        auto rhs = std::make_unique<IntAST>(1);
-        stack.push(std::make_unique<BinaryOperatorAST>('+',
-                                                       std::move(lhs),
-                                                       std::move(rhs)));
-        break;
+      out += '\n';
+      src.remove_prefix(end == std::string_view::npos ? src.size() : end + 1);
+    }
+  }
+
+  // src split into chunks of whole lines
+  std::vector<std::string_view> chunks_of(std::string_view src)
+  {
+    auto ret = std::vector<std::string_view>{};
+    while (!src.empty()) {
+      auto end = src.size() <= chunk_size
+        ? std::string_view::npos
+        : src.find('\n', chunk_size);
+      auto size = end == std::string_view::npos ? src.size() : end + 1;
+      ret.push_back(src.substr(0, size));
+      src.remove_prefix(size);
+    }
+    return ret;
+  }
+
+  // Closes the file, and unmaps it, on the way out
+  struct MappedFile {
+    int fd = -1;
+    void* data = MAP_FAILED;
+    std::size_t size = 0;
+
+    ~MappedFile()
+    {
+      if (data != MAP_FAILED) {
+        ::munmap(data, size);
       }
-      case '2': {
-        auto lhs = std::unique_ptr(std::move(stack.top()));
-        stack.pop();
-        auto rhs = std::make_unique<IntAST>(2);
-        stack.push(
-          std::make_unique<BinaryOperatorAST>('^',
-                                              std::move(lhs),
-                                              std::move(rhs)));
-        break;
+      if (fd != -1) {
+        ::close(fd);
       }
-      case '~': {
-        auto rhs = std::unique_ptr(std::move(stack.top()));
-        stack.pop();
-        stack.push(std::make_unique<NegativeOperatorAST>(
-            std::move(rhs)));
-        break;
+    }
+  };
+
+  // Stops and joins the converting threads however the calling thread
+  // leaves, so that none is left blocked, or joinable.
+  struct ConverterPool {
+    std::vector<std::thread> threads;
+    std::atomic<bool>& stop;
+    std::atomic<std::size_t>& num_handed_over; // Which they may wait on
+
+    ~ConverterPool()
+    {
+      stop.store(true);
+      num_handed_over.fetch_add(1);
+      num_handed_over.notify_all();
+      for (auto& thread : threads) {
+        thread.join();
       }
-      default:
-        assert(false);
-        break;
     }
-  }
+  };
+
+} // namespace
 
-  assert(stack.size() == 1);
-  return std::move(stack.top());
-}
 
-static bool visit(std::unique_ptr<AST>& node)
+void infix_from_reverse_polish_lines(std::string_view src,
+                                     const InfixSink& sink,
+                                     unsigned int num_threads)
 {
-  // Minus Int = another Int
-  // Minus Minus Something = Something
-  if (auto p = dynamic_cast<NegativeOperatorAST*>(node.get())) {
-    if (auto r = dynamic_cast<IntAST*>(p->get_rhs().get())) {
-      auto new_value = -r->get_value();
-      node = std::make_unique<IntAST>(new_value);
-      return true;
-    }
-    if (auto r = dynamic_cast<NegativeOperatorAST*>(p->get_rhs().get())) {
-      node = std::move(r->get_rhs());
-      return true;
+  auto chunks = chunks_of(src);
+
+  if (num_threads <= 1 || chunks.size() <= 1) {
+    auto converter = detail::Converter{};
+    auto out = std::string{};
+    for (auto chunk : chunks) {
+      out.clear();
+      convert_lines(converter, chunk, out);
+      sink(out);
     }
+    return;
   }
 
-  // Evaluate operators acting on integers (only if result is an integer)
-  if (auto p = dynamic_cast<BinaryOperatorAST*>(node.get())) {
-    if (auto l = dynamic_cast<IntAST*>(p->get_lhs().get())) {
-      if (auto r = dynamic_cast<IntAST*>(p->get_rhs().get())){
-        switch (p->get_operator_symbol()) {
-          case '+': {
-            auto new_value = l->get_value() + r->get_value();
-            node = std::make_unique<IntAST>(new_value);
-            return true;
-          }
-          case '-': {
-            auto new_value = l->get_value() - r->get_value();
-            node = std::make_unique<IntAST>(new_value);
-            return true;
-          }
-          case '*': {
-            auto new_value = l->get_value() * r->get_value();
-            node = std::make_unique<IntAST>(new_value);
-            return true;
-          }
-          case '/': {
-            auto a = l->get_value();
-            auto b = r->get_value();
-            if (a % b == 0) {
-              auto new_value = a / b;
-              node = std::make_unique<IntAST>(new_value);
-              return true;
-            }
-          }
-          case '^': {
-            auto new_value = std::pow(l->get_value(), r->get_value());
-            node = std::make_unique<IntAST>(new_value);
-            return true;
+  // The threads claim the chunks in order, and the calling thread hands them
+  // over in order as they are done, the threads staying at most max_ahead
+  // chunks each ahead of it. Once one of them throws, or the sink does, the
+  // others stop, and the first exception is rethrown.
+  auto outputs = std::vector<std::string>(chunks.size());
+  auto is_done = std::vector<std::atomic<bool>>(chunks.size());
+  auto next_chunk = std::atomic<std::size_t>{0};
+  auto num_handed_over = std::atomic<std::size_t>{0};
+  auto window = max_ahead * num_threads;
+  auto stop = std::atomic<bool>{false};
+  auto error = std::exception_ptr{};
+  auto error_mtx = std::mutex{};
+
+  auto convert_chunks = [&] {
+    auto converter = detail::Converter{};
+    while (!stop.load()) {
+      auto i = next_chunk.fetch_add(1, std::memory_order_relaxed);
+      if (i >= chunks.size()) {
+        return;
+      }
+      for (auto n = num_handed_over.load(); i >= n + window && !stop.load();
+           n = num_handed_over.load()) {
+        num_handed_over.wait(n);
+      }
+      if (!stop.load()) {
+        try {
+          convert_lines(converter, chunks[i], outputs[i]);
+        } catch (...) {
+          auto lk = std::scoped_lock{error_mtx};
+          if (!error) {
+            error = std::current_exception();
           }
+          stop.store(true);
         }
       }
+      // Even if given up, for the calling thread not to wait for it
+      is_done[i].store(true, std::memory_order_release);
+      is_done[i].notify_one();
     }
-  }
-
+  };
 
-  // The integer 1 is the multiplication identity.
-  if (auto p = dynamic_cast<BinaryOperatorAST*>(node.get())) {
-    if (auto lhs = dynamic_cast<IntAST*>(p->get_lhs().get())) {
-      if (lhs->get_value() == 1) {
-        node = std::move(p->get_rhs());
-        return true;
-      }
+  {
+    auto pool = ConverterPool{{}, stop, num_handed_over};
+    for (auto t = 0u; t < num_threads; ++t) {
+      pool.threads.emplace_back(convert_chunks);
     }
-    if (auto rhs = dynamic_cast<IntAST*>(p->get_rhs().get())) {
-      if (rhs->get_value() == 1) {
-        node = std::move(p->get_lhs());
-        return true;
+    for (std::size_t i = 0; i < chunks.size(); ++i) {
+      is_done[i].wait(false, std::memory_order_acquire);
+      if (stop.load()) {
+        break;
       }
+      sink(outputs[i]);
+      outputs[i] = std::string{};
+      num_handed_over.store(i + 1);
+      num_handed_over.notify_all();
     }
   }
-
-  return false; // Node has not been modified
-}
-
-
-static void simplify_pass_helper(std::unique_ptr<AST>& root, bool& modified)
-{
-  if (root) {
-    if (auto p = dynamic_cast<FuncAST*>(root.get())) {
-      simplify_pass_helper(p->get_argument(), modified);
-    }
-    if (auto p = dynamic_cast<BinaryOperatorAST*>(root.get())) {
-      simplify_pass_helper(p->get_lhs(), modified);
-      simplify_pass_helper(p->get_rhs(), modified);
-    }
-    if (visit(root)) {
-      modified = true;
-    }
+  if (error) {
+    std::rethrow_exception(error);
   }
 }
 
 
-static bool simplify_pass(std::unique_ptr<AST>& root)
-{
-  auto modified = false;
-  simplify_pass_helper(root, modified);
-  return modified;
-}
-
-
-static void simplify(std::unique_ptr<AST>& root)
+void infix_from_reverse_polish_file(const std::string& path,
+                                    const InfixSink& sink,
+                                    unsigned int num_threads)
 {
-  do {} while (simplify_pass(root));
-}
-
+  auto fail = [&path](const char* what) {
+    throw std::system_error(errno, std::generic_category(),
+                            fmt::format("{} {}", what, path));
+  };
+
+  auto file = MappedFile{};
+  file.fd = ::open(path.c_str(), O_RDONLY);
+  if (file.fd == -1) {
+    fail("open");
+  }
+  struct stat info;
+  if (::fstat(file.fd, &info) != 0) {
+    fail("fstat");
+  }
+  file.size = static_cast<std::size_t>(info.st_size);
+  if (file.size == 0) {
+    return;
+  }
+  file.data = ::mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, file.fd, 0);
+  if (file.data == MAP_FAILED) {
+    fail("mmap");
+  }
+  ::madvise(file.data, file.size, MADV_SEQUENTIAL);
 
-std::string infix_from_reverse_polish(std::string_view src)
-{
-  auto ast = parse_reverse_polish(src);
-  simplify(ast);
-  return ast->to_string();
+  infix_from_reverse_polish_lines(
+    std::string_view(static_cast<const char*>(file.data), file.size),
+    sink, num_threads);
 }
@@ -1,4 +1,47 @@
+#pragma once
+
 #include <string>
 #include <string_view>
+#include <functional>
+#include <memory>
 
 std::string infix_from_reverse_polish(std::string_view src);
+
+
+namespace detail {
+  class Converter;
+}
+
+// Converts expression after expression, reusing its arena from one to the
+// next, so that converting doesn't allocate once it has warmed up.
+class InfixConverter {
+public:
+  InfixConverter();
+  ~InfixConverter();
+  InfixConverter(InfixConverter&&) noexcept;
+  InfixConverter& operator=(InfixConverter&&) noexcept;
+
+  // Appends the infix form of src to out.
+  void convert(std::string_view src, std::string& out);
+
+private:
+  std::unique_ptr<detail::Converter> converter;
+};
+
+
+// Receives the converted lines, a chunk of whole lines at a time
+using InfixSink = std::function<void(std::string_view)>;
+
+// Converts each line of src, an expression in RPN, and hands the infix forms
+// over to sink in the same order, one per line. Empty lines stay empty. With
+// several threads, chunks of lines are converted in parallel, and the sink is
+// still called from the calling thread only.
+void infix_from_reverse_polish_lines(std::string_view src,
+                                     const InfixSink& sink,
+                                     unsigned int num_threads = 1);
+
+// Same, for the lines of a file, which is mapped into memory rather than
+// read. Throws std::system_error if it can't be.
+void infix_from_reverse_polish_file(const std::string& path,
+                                    const InfixSink& sink,
+                                    unsigned int num_threads = 1);
@@ -0,0 +1,84 @@
+///////////////////////////////////////////////////////////////////////////////
+/////////////////////////       samples.cpp      //////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+//
+// The table is read straight into the layout of a BatchSearchJob: one array
+// of xs, and one array of values per integrand, which the engine and its
+// verifiers take as they are.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "samples.h"
+#include <vector>
+#include <stdexcept>
+#include <charconv>
+#include <cmath>
+#include <fmt/format.h>
+
+
+namespace integrator {
+
+  BatchSearchJob read_samples(std::istream& in, const std::string& name)
+  {
+    auto ret = BatchSearchJob{};
+    auto line = std::string{};
+    auto row = std::vector<double>{};
+    for (auto line_number = 1; std::getline(in, line); ++line_number) {
+      auto fail = [&](const std::string& what) {
+        return std::runtime_error(fmt::format("{}:{}: {}", name, line_number,
+                                              what));
+      };
+
+      line = line.substr(0, line.find('#'));
+      row.clear();
+      auto is_separator = [](char c) {
+        return c == ' ' || c == '\t' || c == ',' || c == '\r';
+      };
+      for (auto pos = std::size_t{0}; pos < line.size(); ) {
+        if (is_separator(line[pos])) {
+          ++pos;
+          continue;
+        }
+        auto value = 0.0;
+        auto [end, error] = std::from_chars(line.data() + pos,
+                                            line.data() + line.size(), value);
+        if (error != std::errc{} || (end != line.data() + line.size()
+                                     && !is_separator(*end))) {
+          throw fail(fmt::format("not a number: {}", line.substr(pos)));
+        }
+        if (!std::isfinite(value)) {
+          throw fail("not finite");
+        }
+        row.push_back(value);
+        pos = end - line.data();
+      }
+      if (row.empty()) {
+        continue;
+      }
+
+      if (ret.xs.empty()) {
+        if (row.size() < 2) {
+          throw fail("expected an x and at least one value");
+        }
+        ret.integrands.resize(row.size() - 1);
+      } else if (row.size() != ret.integrands.size() + 1) {
+        throw fail(fmt::format("expected {} columns, got {}",
+                               ret.integrands.size() + 1, row.size()));
+      }
+      ret.xs.push_back(row[0]);
+      for (std::size_t i = 0; i < ret.integrands.size(); ++i) {
+        ret.integrands[i].push_back(row[i + 1]);
+      }
+    }
+
+    if (in.bad()) {
+      throw std::runtime_error(fmt::format("{}: read error", name));
+    }
+    if (ret.xs.empty()) {
+      throw std::runtime_error(fmt::format("{}: no samples", name));
+    }
+    return ret;
+  }
+
+} // namespace integrator
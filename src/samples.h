@@ -0,0 +1,18 @@
+#pragma once
+
+#include "search.h"
+#include <string>
+#include <istream>
+
+
+namespace integrator {
+
+  // Reads a table of samples, one row per x: the x, and then the value of
+  // each integrand there, separated by blanks or commas. Blank lines and the
+  // rest of a line from a '#' are ignored. Each column of values is an
+  // integrand of the returned job, which has its xs and integrands filled
+  // in, and the rest left to their defaults. Throws std::runtime_error,
+  // naming `name` and the line, if the table is malformed or empty.
+  BatchSearchJob read_samples(std::istream& in, const std::string& name);
+
+} // namespace integrator
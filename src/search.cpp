@@ -0,0 +1,1033 @@
+///////////////////////////////////////////////////////////////////////////////
+/////////////////////////       search.cpp       //////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+//
+// The search engine runs a pool of workers that compose random expressions
+// and verify them against the integrands of a job, until they all have an
+// antiderivative. Short expressions are first covered exhaustively, either
+// enumerated in chunks that the workers claim from a shared cursor, or built
+// bottom-up by one of them.
+//
+// Every candidate is evaluated once at the first x, and looked up among the
+// integrands sorted by their value there, so that a job of many integrands
+// costs about as much as a job of one. The hot loops are free of locks:
+// attempts are counted per worker, and each integrand is resolved with a
+// single compare-exchange.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "search.h"
+#include "integrator.h"
+#include "rejection_cache.h"
+#include "enumerator.h"
+#include "bottom_up.h"
+#include "candidate_pool.h"
+#include "length_schedule.h"
+#include "checkpoint.h"
+#include "near_miss.h"
+#include <atomic>
+#include <array>
+#include <limits>
+#include <cassert>
+#include <cmath>
+#include <optional>
+#include <algorithm>
+#include <compare>
+#include <bit>
+#include <fstream>
+#include <fmt/format.h>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace integrator {
+
+  // What one worker did with its candidates, as in SearchStats. The counters
+  // of a worker start on a cache line of their own, so that the workers
+  // bumping theirs don't invalidate each other's, and only that worker writes
+  // to them, so that no RMW is needed. The common cases are left to be
+  // derived, so that most candidates only bump num_by_size: the attempts sum
+  // it up, and the candidates rejected at the first point are all the others.
+  struct alignas(64) WorkerCounters {
+    std::array<std::atomic<unsigned long>, expr_max_size + 1> num_by_size{};
+    std::atomic<unsigned long> num_skipped{0};
+    std::atomic<unsigned long> num_non_finite{0};
+    std::atomic<unsigned long> num_near{0}; // Candidates verified at all
+    std::atomic<unsigned long> num_verifications{0};
+    std::atomic<unsigned long> num_unconfirmed{0};
+    std::atomic<unsigned long> num_resumed{0}; // Attempts before a checkpoint
+    std::atomic<unsigned long> num_mutations{0};
+    std::atomic<unsigned long> num_near_misses{0};
+    std::atomic<unsigned long> num_dropped_near_misses{0};
+
+    static void bump(std::atomic<unsigned long>& counter)
+    {
+      counter.store(counter.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    }
+
+    void add_attempt(std::size_t size)
+    {
+      bump(num_by_size[size]);
+    }
+
+    unsigned long num_attempts() const
+    {
+      auto sum = num_resumed.load(std::memory_order_relaxed);
+      for (const auto& n : num_by_size) {
+        sum += n.load(std::memory_order_relaxed);
+      }
+      return sum;
+    }
+  };
+
+
+  // One integrand of a job, resolved by at most one worker
+  struct IntegrandState {
+    std::vector<double> ys; // At the xs of the job
+    std::vector<Point> points;
+    std::vector<Point> held_out; // Only for the final check
+    std::promise<SearchResult> promise;
+    std::atomic<bool> is_resolved{false};
+  };
+
+
+  struct SearchJobState {
+    SearchJobState(BatchSearchJob job, uint64_t seq, unsigned int num_workers)
+      : job{std::move(job)},
+      seq{seq},
+      integrands(this->job.integrands.size()),
+      counters(num_workers),
+      tolerance{std::sqrt(this->job.near_miss_path.empty()
+                          ? loss_cutoff(Differentiation::automatic)
+                          : std::max(loss_cutoff(Differentiation::automatic),
+                                     this->job.near_miss_cutoff))},
+      num_unresolved{static_cast<unsigned int>(integrands.size())},
+      num_remaining{num_workers}
+    {
+      for (std::size_t i = 0; i < integrands.size(); ++i) {
+        auto& integrand = integrands[i];
+        integrand.ys = this->job.integrands[i];
+        assert(integrand.ys.size() == this->job.xs.size());
+        for (std::size_t k = 0; k < integrand.ys.size(); ++k) {
+          integrand.points.push_back({this->job.xs[k], integrand.ys[k]});
+        }
+        by_first_value.push_back({integrand.ys.front(), i});
+      }
+      std::sort(by_first_value.begin(), by_first_value.end());
+    }
+
+    const BatchSearchJob job;
+    const uint64_t seq;
+    std::vector<IntegrandState> integrands;
+    // The integrands by their value at the first x, to match candidates
+    // against all of them with a binary search
+    std::vector<std::pair<double, std::size_t>> by_first_value;
+
+    std::vector<WorkerCounters> counters; // Per worker
+    // Largest error at the first point of a candidate worth verifying, or
+    // logging, with a near-miss log only
+    const double tolerance;
+    std::atomic<unsigned int> num_unresolved;
+    std::atomic<bool> cancelled{false};
+    std::atomic<unsigned int> num_remaining; // Workers yet to leave the job
+    RejectionCache rejected; // Candidates that match none of the integrands
+
+    // Number of chunks of enumerated programs claimed by the workers
+    alignas(64) std::atomic<uint64_t> num_claimed{0};
+    // Size up to which every program is known to be wrong
+    std::atomic<std::size_t> exhausted_size{0};
+
+    std::unique_ptr<Checkpoint> checkpoint; // Null if none
+    std::unique_ptr<NearMissLog> near_misses; // Likewise
+
+    unsigned long total_attempts() const
+    {
+      auto sum = 0ul;
+      for (const auto& counter : counters) {
+        sum += counter.num_attempts();
+      }
+      return sum;
+    }
+
+    SearchStats stats() const
+    {
+      auto ret = SearchStats{};
+      auto add = [](unsigned long& sum,
+                    const std::atomic<unsigned long>& counter) {
+        sum += counter.load(std::memory_order_relaxed);
+      };
+      auto num_near = 0ul;
+      for (const auto& counter : counters) {
+        add(ret.num_skipped, counter.num_skipped);
+        add(ret.num_non_finite, counter.num_non_finite);
+        add(num_near, counter.num_near);
+        add(ret.num_verifications, counter.num_verifications);
+        add(ret.num_unconfirmed, counter.num_unconfirmed);
+        add(ret.num_resumed_attempts, counter.num_resumed);
+        add(ret.num_mutations, counter.num_mutations);
+        add(ret.num_near_misses, counter.num_near_misses);
+        add(ret.num_dropped_near_misses, counter.num_dropped_near_misses);
+        for (std::size_t i = 0; i < ret.num_by_size.size(); ++i) {
+          add(ret.num_by_size[i], counter.num_by_size[i]);
+        }
+      }
+      auto num_made = 0ul; // Since the job was resumed, if it was
+      for (auto n : ret.num_by_size) {
+        num_made += n;
+      }
+      ret.num_attempts = ret.num_resumed_attempts + num_made;
+      // The counters are read one after the other while they move on.
+      auto num_others = ret.num_skipped + ret.num_non_finite + num_near;
+      ret.num_first_point_rejections =
+        num_made > num_others ? num_made - num_others : 0;
+      return ret;
+    }
+
+    // Carries on from the states saved to the checkpoint, if any.
+    void resume(std::unique_ptr<Checkpoint> from)
+    {
+      checkpoint = std::move(from);
+      const auto& states = checkpoint->resumed();
+      if (states.empty()) {
+        return;
+      }
+
+      // Each worker enumerates its chunks in order, so every chunk claimed
+      // before the first one that a worker was still on is done. A worker
+      // that never saved may have claimed any chunk.
+      auto claim = std::numeric_limits<uint64_t>::max();
+      for (std::size_t id = 0; id < states.size(); ++id) {
+        counters[id].num_resumed.store(states[id].num_attempts,
+                                       std::memory_order_relaxed);
+        claim = std::min(claim,
+                         states[id].rng_state != 0 ? states[id].claim : 0);
+      }
+      num_claimed.store(claim, std::memory_order_relaxed);
+    }
+
+    bool is_over() const
+    {
+      return num_unresolved.load(std::memory_order_relaxed) == 0
+        || cancelled.load(std::memory_order_relaxed);
+    }
+
+    // Calls f with the index of every unresolved integrand that a candidate
+    // whose derivative at the first x is `deriv` may be an antiderivative of.
+    template<typename F>
+    void for_each_near(double deriv, F&& f)
+    {
+      auto it = std::lower_bound(
+        by_first_value.begin(), by_first_value.end(),
+        std::pair{deriv - tolerance, std::size_t{0}});
+      for (; it != by_first_value.end() && it->first < deriv + tolerance;
+           ++it) {
+        if (!integrands[it->second].is_resolved.load(
+                std::memory_order_relaxed)) {
+          f(it->second);
+        }
+      }
+    }
+
+    // Index of the integrand whose value at the first x is closest to deriv
+    std::size_t nearest(double deriv) const
+    {
+      auto it = std::lower_bound(by_first_value.begin(), by_first_value.end(),
+                                 std::pair{deriv, std::size_t{0}});
+      if (it == by_first_value.end()
+          || (it != by_first_value.begin()
+              && deriv - std::prev(it)->first < it->first - deriv)) {
+        --it;
+      }
+      return it->second;
+    }
+
+    // The final check of a program that passed the verifiers of integrand i
+    bool confirm(std::size_t i, BytecodeView code) const
+    {
+      const auto& integrand = integrands[i];
+      return is_confirmed(code, integrand.points)
+        && is_confirmed(code, integrand.held_out);
+    }
+
+    // Hands the result over to the integrand's future right away, unless
+    // some other worker resolved it first.
+    void resolve(std::size_t i, std::string expr)
+    {
+      auto expected = false;
+      auto& integrand = integrands[i];
+      if (!integrand.is_resolved.compare_exchange_strong(
+              expected, true, std::memory_order_relaxed)) {
+        return;
+      }
+      integrand.promise.set_value({std::move(expr), total_attempts(), false});
+      num_unresolved.fetch_sub(1, std::memory_order_relaxed);
+    }
+  };
+
+
+  // The verifiers of one worker for the integrands of a job, built the first
+  // time a candidate comes close to the integrand.
+  class Matcher {
+  public:
+    // `seed` is that of the worker's random stream, for the near-miss log.
+    Matcher(SearchJobState& job, unsigned int id, uint32_t seed)
+      : job{job},
+      id{id},
+      seed{seed},
+      counters{job.counters[id]},
+      verifiers(job.integrands.size())
+    { }
+
+    // Verifies a candidate whose derivative at the first x is `deriv` against
+    // the integrands close to it there, and resolves the ones it is an
+    // antiderivative of. Returns whether there was any.
+    bool match(const Candidate& candidate, double deriv)
+    {
+      auto ret = false;
+      auto is_near = false;
+      job.for_each_near(deriv, [&](std::size_t i) {
+        is_near = true;
+        WorkerCounters::bump(counters.num_verifications);
+        auto& verifier = verifiers[i];
+        if (!verifier) {
+          verifier.emplace(job.integrands[i].points);
+        }
+        if (job.near_misses) {
+          record(candidate, i, *verifier);
+        }
+        if (!verifier->is_correct_integral(candidate.bytecode())) {
+          return;
+        }
+        if (job.confirm(i, candidate.bytecode())) {
+          job.resolve(i, candidate.to_string());
+          ret = true;
+        } else {
+          WorkerCounters::bump(counters.num_unconfirmed);
+        }
+      });
+      if (is_near) {
+        WorkerCounters::bump(counters.num_near);
+      }
+      return ret;
+    }
+
+  private:
+    SearchJobState& job;
+    unsigned int id;
+    uint32_t seed;
+    WorkerCounters& counters;
+    std::vector<std::optional<Verifier>> verifiers;
+
+    void record(const Candidate& candidate, std::size_t i, Verifier& verifier)
+    {
+      auto loss = verifier.loss(candidate.bytecode());
+      if (!(loss < job.job.near_miss_cutoff)) {
+        return;
+      }
+      if (job.near_misses->record(id, candidate, loss, i, seed,
+                                  counters.num_attempts())) {
+        WorkerCounters::bump(counters.num_near_misses);
+      } else {
+        WorkerCounters::bump(counters.num_dropped_near_misses);
+      }
+    }
+  };
+
+
+  // The exploitation side of the random search of a worker: the programs of
+  // lowest loss it came across, to draw mutations of. Consecutive mutations
+  // mostly share a prefix, so the first point is tested incrementally.
+  class LocalSearch {
+  public:
+    LocalSearch(SearchJobState& job, uint32_t seed)
+      : job{job},
+      rng{seed},
+      prefix(job.job.xs.front()),
+      duals(job.job.xs.size())
+    { }
+
+    // Tells whether the next attempt is a mutation, so that they make up the
+    // share of the attempts the job asks for, once there is anything to
+    // mutate.
+    bool is_due()
+    {
+      credit = std::min(credit + job.job.exploitation, 1.0);
+      if (credit < 1.0 || pool.empty()) {
+        return false;
+      }
+      credit -= 1.0;
+      return true;
+    }
+
+    // Writes to `candidate` a mutation of one of the programs of the pool.
+    void mutate(Composer& composer, Candidate& candidate)
+    {
+      composer.mutate(pool.draw(rng).candidate, candidate);
+      if (++num_stale == max_stale) {
+        pool.clear();
+        num_stale = 0;
+      }
+    }
+
+    // Evaluates a mutation at the first x, like eval_dual_checked.
+    std::optional<Dual> eval(const Candidate& candidate)
+    {
+      auto end = candidate.code.begin() + candidate.size;
+      auto from = std::mismatch(candidate.code.begin(), end,
+                                last.code.begin(),
+                                last.code.begin() + last.size).first
+        - candidate.code.begin();
+      last = candidate;
+      return prefix.eval(candidate.bytecode(), from);
+    }
+
+    // Takes in a candidate whose derivative at the first x is `deriv`, if it
+    // is closer to its nearest integrand than the worst of the pool. The
+    // first point alone bounds the loss, and mostly spares evaluating the
+    // others.
+    void offer(const Candidate& candidate, double deriv)
+    {
+      auto i = job.nearest(deriv);
+      const auto& ys = job.integrands[i].ys;
+      double delta = deriv - ys[0];
+      if (!(delta * delta < pool.worst_loss())) {
+        return;
+      }
+      if (!Evaluator::eval_batch_checked(candidate.bytecode(), job.job.xs,
+                                         std::span(duals))) {
+        return;
+      }
+      auto loss = 0.0;
+      for (std::size_t k = 0; k < ys.size(); ++k) {
+        delta = duals[k].deriv - ys[k];
+        loss += delta * delta;
+      }
+      if (pool.offer(candidate, loss, i)) {
+        num_stale = 0;
+      }
+    }
+
+    // Forgets the programs close to integrands resolved since.
+    void prune()
+    {
+      pool.remove_if([this](const CandidatePool::Entry& entry) {
+        return job.integrands[entry.integrand].is_resolved.load(
+            std::memory_order_relaxed);
+      });
+    }
+
+  private:
+    // Mutations in a row that the pool took none of, after which it is
+    // stuck around programs that are close but not quite right, and starts
+    // over from the next random ones.
+    static constexpr unsigned int max_stale = 300;
+
+    SearchJobState& job;
+    CustomGenerator rng; // To draw from the pool
+    CandidatePool pool;
+    PrefixEvaluator<Dual> prefix;
+    Candidate last{}; // Evaluated by prefix
+    std::vector<Dual> duals; // At the xs of the job
+    double credit = 0.0; // Mutations due
+    unsigned int num_stale = 0;
+  };
+
+
+  void SearchHandle::cancel()
+  {
+    job->cancelled.store(true, std::memory_order_relaxed);
+  }
+
+
+  unsigned long SearchHandle::num_attempts() const
+  {
+    return job->total_attempts();
+  }
+
+
+  SearchStats SearchHandle::stats() const
+  {
+    return job->stats();
+  }
+
+
+  void BatchSearchHandle::cancel()
+  {
+    job->cancelled.store(true, std::memory_order_relaxed);
+  }
+
+
+  SearchStats BatchSearchHandle::stats() const
+  {
+    return job->stats();
+  }
+
+
+  struct SearchEngine::Worker {
+    Composer composer;
+    uint32_t seed; // Of the composer
+    uint64_t claim = 0; // Last chunk claimed in the current job
+  };
+
+
+  // Identifies a job for its checkpoint, all but its budget.
+  static uint64_t hash_of(const BatchSearchJob& job)
+  {
+    auto ret = uint64_t{0};
+    auto add = [&ret](uint64_t v) { ret = mix64(ret ^ v) + v; };
+    auto add_double = [&add](double v) {
+      add(std::bit_cast<uint64_t>(v));
+    };
+    for (auto x : job.xs) {
+      add_double(x);
+    }
+    for (const auto& ys : job.integrands) {
+      add(ys.size());
+      for (auto y : ys) {
+        add_double(y);
+      }
+    }
+    add(job.exhaustive_size);
+    add(static_cast<uint64_t>(job.exhaustive));
+    add(job.partition);
+    add(job.num_partitions);
+    add(job.random_length);
+    add(job.adaptive_length);
+    add(job.num_held_out);
+    add_double(job.exploitation);
+    return ret;
+  }
+
+
+  // Takes the points held out of the search off the job, and returns them,
+  // per integrand.
+  static std::vector<std::vector<Point>> hold_out(BatchSearchJob& job)
+  {
+    auto ret = std::vector<std::vector<Point>>(job.integrands.size());
+    auto num_searched = job.xs.size() - job.num_held_out;
+    for (std::size_t i = 0; i < ret.size(); ++i) {
+      auto& ys = job.integrands[i];
+      for (auto k = num_searched; k < job.xs.size(); ++k) {
+        ret[i].push_back({job.xs[k], ys[k]});
+      }
+      ys.resize(num_searched);
+    }
+    job.xs.resize(num_searched);
+    return ret;
+  }
+
+
+  // Derives independent, non-zero seeds for the workers.
+  static uint32_t worker_seed(unsigned int seed, unsigned int id)
+  {
+    uint64_t z = uint64_t{seed} << 32 | id;
+    auto ret = static_cast<uint32_t>(splitmix64(z));
+    return ret != 0 ? ret : 1;
+  }
+
+
+  // Pins the calling thread to a logical CPU.
+  static void pin_to_cpu(int cpu)
+  {
+#if defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+    (void)cpu;
+#endif
+  }
+
+
+  // A logical CPU that the process may run on
+  struct Cpu {
+    int sibling_rank; // Among the hardware threads of its physical core
+    int package;      // Socket
+    int core;
+    int id;
+    auto operator<=>(const Cpu&) const = default;
+  };
+
+  // The CPUs that the process may run on, one per physical core, socket after
+  // socket, before any second hardware thread of a core. Empty if unknown.
+  static std::vector<Cpu> topology()
+  {
+    auto ret = std::vector<Cpu>{};
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+      return ret;
+    }
+
+    auto read = [](int cpu, const char* file) {
+      auto in = std::ifstream(fmt::format(
+          "/sys/devices/system/cpu/cpu{}/topology/{}", cpu, file));
+      int ret = -1;
+      in >> ret;
+      return ret;
+    };
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (!CPU_ISSET(cpu, &allowed)) {
+        continue;
+      }
+      auto package = read(cpu, "physical_package_id");
+      auto core = read(cpu, "core_id");
+      if (core == -1) {
+        core = cpu; // Unknown topology, each CPU is taken as a core
+      }
+      auto rank = static_cast<int>(std::count_if(
+          ret.begin(), ret.end(), [package, core](const Cpu& other) {
+            return other.package == package && other.core == core;
+          }));
+      ret.push_back({rank, package, core, cpu});
+    }
+    std::sort(ret.begin(), ret.end());
+#endif
+    return ret;
+  }
+
+
+  SearchEngine::SearchEngine(unsigned int num_threads, unsigned int seed,
+                             Placement placement)
+  {
+    auto cpus = topology();
+    if (num_threads == 0) {
+      num_threads = std::count_if(cpus.begin(), cpus.end(),
+                                  [](const Cpu& cpu) {
+                                    return cpu.sibling_rank == 0;
+                                  });
+      if (num_threads == 0) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+      }
+    }
+    if (placement == Placement::pinned) {
+      std::sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) {
+        return a.id < b.id;
+      });
+    }
+
+    workers.resize(num_threads);
+    for (auto i = 0u; i < num_threads; ++i) {
+      auto cpu = placement == Placement::floating || cpus.empty()
+        ? -1
+        : cpus[i % cpus.size()].id;
+      threads.emplace_back(&SearchEngine::work, this, i, seed, cpu);
+    }
+  }
+
+
+  SearchEngine::~SearchEngine()
+  {
+    {
+      auto lk = std::scoped_lock{mtx};
+      stopping = true;
+      for (auto& job : jobs) {
+        job->cancelled.store(true, std::memory_order_relaxed);
+      }
+    }
+    job_submitted.notify_all();
+
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
+
+  SearchHandle SearchEngine::submit(SearchJob job)
+  {
+    auto batch = BatchSearchJob{};
+    batch.integrands.emplace_back();
+    for (const auto& [x, y] : job.integrand_points) {
+      batch.xs.push_back(x);
+      batch.integrands.back().push_back(y);
+    }
+    batch.max_attempts = job.max_attempts;
+    batch.exhaustive_size = job.exhaustive_size;
+    batch.exhaustive = job.exhaustive;
+    batch.partition = job.partition;
+    batch.num_partitions = job.num_partitions;
+    batch.random_length = job.random_length;
+    batch.adaptive_length = job.adaptive_length;
+    batch.num_held_out = job.num_held_out;
+    batch.exploitation = job.exploitation;
+    batch.checkpoint_path = std::move(job.checkpoint_path);
+    batch.near_miss_path = std::move(job.near_miss_path);
+    batch.near_miss_cutoff = job.near_miss_cutoff;
+
+    auto handle = submit(std::move(batch));
+    return SearchHandle(std::move(handle.job),
+                        std::move(handle.futures.front()));
+  }
+
+
+  BatchSearchHandle SearchEngine::submit(BatchSearchJob job)
+  {
+    if (job.max_attempts == 0) {
+      job.max_attempts = std::numeric_limits<decltype(job.max_attempts)>::max();
+    }
+
+    assert(!job.xs.empty() && !job.integrands.empty());
+    assert(job.partition < job.num_partitions);
+    assert(job.exhaustive != Exhaustive::enumerated
+           || job.exhaustive_size <= Enumerator::max_max_size);
+    assert(job.random_length >= 1
+           && 2*job.random_length + 1 <= int{expr_max_size});
+    assert(job.num_held_out < job.xs.size());
+
+    auto checkpoint = std::unique_ptr<Checkpoint>{};
+    if (!job.checkpoint_path.empty()) {
+      checkpoint = std::make_unique<Checkpoint>(job.checkpoint_path,
+                                                hash_of(job), num_threads());
+    }
+    auto near_misses = std::unique_ptr<NearMissLog>{};
+    if (!job.near_miss_path.empty()) {
+      near_misses = std::make_unique<NearMissLog>(job.near_miss_path,
+                                                  num_threads());
+    }
+
+    auto held_out = hold_out(job);
+    auto lk = std::scoped_lock{mtx};
+    auto state = std::make_shared<SearchJobState>(std::move(job), next_seq++,
+                                                  num_threads());
+    for (std::size_t i = 0; i < held_out.size(); ++i) {
+      state->integrands[i].held_out = std::move(held_out[i]);
+    }
+    if (checkpoint) {
+      state->resume(std::move(checkpoint));
+    }
+    state->near_misses = std::move(near_misses);
+    auto futures = std::vector<std::future<SearchResult>>{};
+    for (auto& integrand : state->integrands) {
+      futures.push_back(integrand.promise.get_future());
+    }
+    if (stopping) {
+      state->cancelled.store(true, std::memory_order_relaxed);
+    }
+    jobs.push_back(state);
+    job_submitted.notify_all();
+
+    return BatchSearchHandle(std::move(state), std::move(futures));
+  }
+
+
+  // Every worker goes through every job, in order, and a job is only popped
+  // once all the workers have left it. Hence the next job of a worker is
+  // always in the queue once submitted.
+  void SearchEngine::work(unsigned int id, unsigned int seed, int cpu)
+  {
+    if (cpu != -1) {
+      pin_to_cpu(cpu);
+    }
+    auto rng_seed = worker_seed(seed, id);
+    workers[id] = std::make_unique<Worker>(
+        Worker{Composer(rng_seed), rng_seed});
+
+    for (auto seq = uint64_t{0}; ; ++seq) {
+      auto job = std::shared_ptr<SearchJobState>{};
+      {
+        auto lk = std::unique_lock{mtx};
+        auto has_next = [this, seq] {
+          return !jobs.empty() && jobs.back()->seq >= seq;
+        };
+        job_submitted.wait(lk, [this, &has_next] {
+          return stopping || has_next();
+        });
+        if (!has_next()) {
+          return;
+        }
+        job = jobs[seq - jobs.front()->seq];
+      }
+
+      run(id, *job);
+      save(id, *job);
+      leave(*job);
+    }
+  }
+
+
+  void SearchEngine::run(unsigned int id, SearchJobState& job)
+  {
+    auto& worker = *workers[id];
+    worker.claim = 0;
+    if (job.checkpoint && !job.checkpoint->resumed().empty()) {
+      const auto& state = job.checkpoint->resumed()[id];
+      if (state.rng_state != 0) {
+        worker.composer = Composer(state.rng_state);
+        worker.claim = state.claim;
+      }
+    }
+
+    if (job.is_over()) {
+      return;
+    }
+
+    auto is_done = job.job.exhaustive == Exhaustive::enumerated
+      ? enumerate(id, job)
+      : grow_bottom_up(id, job);
+    if (is_done) {
+      return;
+    }
+
+    auto& composer = worker.composer;
+    auto& counters = job.counters[id];
+    auto matcher = Matcher(job, id, worker.seed);
+    auto candidate = Candidate{};
+    auto x = job.job.xs.front();
+    auto local_search = std::optional<LocalSearch>{};
+    if (job.job.exploitation > 0.0) {
+      local_search.emplace(job, worker.seed);
+    }
+    auto schedule = std::optional<LengthSchedule>{};
+    if (job.job.adaptive_length) {
+      // Not the stream of the composer, nor of the local search
+      schedule.emplace(job.job.random_length,
+                       (worker.seed ^ 0x5bd1e995u) | 1u);
+    }
+
+    // The other counters are only summed up once every N attempts.
+    constexpr auto N = 10000;
+    while (true) {
+      for (int attempt = 0; attempt < N; ++attempt) {
+        if (job.is_over()) {
+          return;
+        }
+
+        auto is_mutation = local_search && local_search->is_due();
+        auto is_scheduled = !is_mutation && schedule;
+        if (is_mutation) {
+          local_search->mutate(composer, candidate);
+          WorkerCounters::bump(counters.num_mutations);
+        } else if (is_scheduled) {
+          composer.gen_random_code(schedule->next(), candidate);
+        } else {
+          composer.compose(job.job.random_length, candidate);
+        }
+        counters.add_attempt(candidate.size);
+        if (candidate.size <= job.exhausted_size.load(
+                std::memory_order_relaxed)) {
+          WorkerCounters::bump(counters.num_skipped);
+          continue; // Already covered, and wrong
+        }
+
+        auto hash = uint64_t{0};
+        if (candidate.size <= RejectionCache::max_candidate_size) {
+          hash = canonical_hash(candidate.bytecode());
+          if (job.rejected.contains(hash)) {
+            WorkerCounters::bump(counters.num_skipped);
+            continue;
+          }
+        }
+
+        auto dual = is_mutation
+          ? local_search->eval(candidate)
+          : Evaluator::eval_dual_checked(candidate.bytecode(), x);
+        if (dual && is_scheduled) {
+          schedule->verified(candidate);
+        }
+        if (!dual) {
+          WorkerCounters::bump(counters.num_non_finite);
+        } else if (matcher.match(candidate, dual->deriv)) {
+          continue;
+        } else if (local_search) {
+          local_search->offer(candidate, dual->deriv);
+        }
+        if (hash != 0) {
+          job.rejected.insert(hash);
+        }
+      }
+      if (local_search) {
+        local_search->prune();
+      }
+      save(id, job);
+      if (job.total_attempts() > job.job.max_attempts) {
+        return;
+      }
+    }
+  }
+
+
+  // Claims chunks of the programs up to the exhaustive size until there are
+  // none left. Returns true if the worker is done with the job, be it
+  // resolved, cancelled, or out of attempts.
+  bool SearchEngine::enumerate(unsigned int id, SearchJobState& job)
+  {
+    auto enumerator = Enumerator(job.job.exhaustive_size);
+    auto& counters = job.counters[id];
+    auto matcher = Matcher(job, id, workers[id]->seed);
+    auto candidate = Candidate{};
+
+    // Consecutive programs mostly differ in their last opcodes, so the first
+    // point is tested incrementally, and the verifiers only see survivors.
+    auto prefix = PrefixEvaluator<Dual>(job.job.xs.front());
+
+    // Small enough for the workers to finish at about the same time, and
+    // large enough for the cursor not to be contended.
+    constexpr auto chunk_size = uint64_t{4096};
+    auto count = enumerator.count();
+    while (true) {
+      auto claim = job.num_claimed.fetch_add(1, std::memory_order_relaxed);
+      workers[id]->claim = claim;
+      save(id, job);
+      auto chunk = claim * job.job.num_partitions + job.job.partition;
+      auto begin = chunk * chunk_size;
+      if (begin >= count) {
+        job.exhausted_size.store(job.job.exhaustive_size,
+                                 std::memory_order_relaxed);
+        return false;
+      }
+      auto end = std::min(begin + chunk_size, count);
+
+      enumerator.seek(begin, candidate);
+      for (auto index = begin; index < end; ++index) {
+        if (job.is_over()) {
+          return true;
+        }
+
+        counters.add_attempt(candidate.size);
+        auto dual = prefix.eval(candidate.bytecode(),
+                                enumerator.num_unchanged());
+        if (dual) {
+          matcher.match(candidate, dual->deriv);
+        } else {
+          WorkerCounters::bump(counters.num_non_finite);
+        }
+        enumerator.next(candidate);
+      }
+      if (job.total_attempts() > job.job.max_attempts) {
+        return true;
+      }
+    }
+  }
+
+
+  // Has the first worker build expressions bottom-up to the exhaustive size,
+  // raising the exhausted size as it goes. Returns like enumerate.
+  bool SearchEngine::grow_bottom_up(unsigned int id, SearchJobState& job)
+  {
+    if (id != 0) {
+      return false;
+    }
+
+    auto search = BottomUpSearch(job.job.xs);
+    auto& counters = job.counters[id];
+
+    // Of the expressions being built, as next_size() has moved on by then
+    auto size = std::size_t{0};
+    constexpr auto N = 10000;
+    auto attempt = 0;
+    auto keep_going = [&] {
+      counters.add_attempt(size);
+      if (++attempt % N == 0
+          && job.total_attempts() > job.job.max_attempts) {
+        return false;
+      }
+      return !job.is_over();
+    };
+
+    // Only one program of each fingerprint is kept, and the fingerprints
+    // leave out the held-out points, and extended precision. Hence, once
+    // the final check could have failed a program that an equivalent one
+    // would pass, the random workers must not skip the sizes covered.
+    auto is_covered = job.job.num_held_out == 0;
+
+    // The fingerprints hold the derivatives at every x, so the integrands
+    // can be tested on the spot.
+    auto cutoff = loss_cutoff(Differentiation::automatic);
+    auto test = [&job, &counters, &is_covered, cutoff](
+        std::span<const Dual> fingerprint, const auto& expr) {
+      job.for_each_near(fingerprint[0].deriv, [&](std::size_t i) {
+        WorkerCounters::bump(counters.num_verifications);
+        const auto& ys = job.integrands[i].ys;
+        auto loss = 0.0;
+        for (std::size_t k = 0; k < ys.size(); ++k) {
+          double delta = fingerprint[k].deriv - ys[k];
+          loss += delta * delta;
+        }
+        if (!(loss < cutoff)) {
+          return;
+        }
+        auto str = expr();
+        if (job.confirm(i, Evaluator::compile_bytecode(str))) {
+          job.resolve(i, std::move(str));
+        } else {
+          WorkerCounters::bump(counters.num_unconfirmed);
+          is_covered = false;
+        }
+      });
+    };
+
+    while (search.next_size() <= job.job.exhaustive_size) {
+      size = search.next_size();
+      if (!search.grow(keep_going, test)) {
+        // Given up, or too many expressions to keep them all
+        return job.is_over()
+          || job.total_attempts() > job.job.max_attempts;
+      }
+      if (is_covered) {
+        job.exhausted_size.store(size, std::memory_order_relaxed);
+      }
+    }
+    return job.is_over();
+  }
+
+
+  void SearchEngine::save(unsigned int id, SearchJobState& job)
+  {
+    if (!job.checkpoint) {
+      return;
+    }
+    const auto& worker = *workers[id];
+    job.checkpoint->save(id, {worker.composer.generator().get_state(),
+                              job.counters[id].num_attempts(),
+                              worker.claim});
+  }
+
+
+  // The last worker to leave a job fulfils the promises of the integrands not
+  // resolved. The acq_rel decrement makes the resolutions of all the other
+  // workers visible to it.
+  void SearchEngine::leave(SearchJobState& job)
+  {
+    if (job.num_remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+
+    if (job.checkpoint) {
+      job.checkpoint->flush();
+    }
+    job.near_misses.reset(); // Written out in full
+
+    auto result = SearchResult{};
+    result.num_attempts = job.total_attempts();
+    result.cancelled = job.cancelled.load();
+    for (auto& integrand : job.integrands) {
+      if (!integrand.is_resolved.load(std::memory_order_relaxed)) {
+        integrand.promise.set_value(result);
+      }
+    }
+
+    auto lk = std::scoped_lock{mtx};
+    assert(jobs.front().get() == &job);
+    jobs.pop_front();
+  }
+
+
+  std::pair<std::string, unsigned long>
+  search(const std::vector<Point>& integrand_points,
+         unsigned int seed,
+         unsigned int num_threads,
+         unsigned long max_attempts)
+  {
+    auto engine = SearchEngine(num_threads, seed);
+    auto handle = engine.submit({integrand_points, max_attempts});
+    auto result = handle.result().get();
+    return {std::move(result.expr), result.num_attempts};
+  }
+
+} // namespace integrator
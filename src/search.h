@@ -0,0 +1,251 @@
+#pragma once
+
+#include "verifier.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <memory>
+#include <future>
+#include <array>
+#include <thread>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace integrator {
+
+  // How the programs up to SearchJob::exhaustive_size are covered
+  enum class Exhaustive {
+    enumerated, // Each of them, the workers sharing the work
+    bottom_up,  // One per fingerprint, by one worker while the others sample
+  };
+
+  // An integrand to find an antiderivative of
+  struct SearchJob {
+    std::vector<Point> integrand_points;
+    unsigned long max_attempts = 0; // 0 means no limit
+
+    // Every program up to this size is covered once before turning to random
+    // candidates, of which the ones this short are then skipped. There are
+    // about 4e5 programs up to size 6, and 13 times as many per extra opcode,
+    // though bottom-up search only builds a fraction of them.
+    std::size_t exhaustive_size = 6;
+    Exhaustive exhaustive = Exhaustive::enumerated;
+
+    // Of the chunks of enumerated programs, only those whose index is
+    // `partition` modulo `num_partitions` are tried, the others being left to
+    // other engines, e.g. on other machines.
+    unsigned int partition = 0;
+    unsigned int num_partitions = 1;
+
+    // The random candidates are composed of 2 to random_length + 1 draws,
+    // as by Composer::compose, of at most 31.
+    int random_length = 20;
+
+    // Lets every worker choose the lengths of its random candidates by
+    // LengthSchedule, which starts from those above, and favours the ones
+    // that yield the most new candidates per second. As it goes by the
+    // clock, the candidates are not reproducible from the seed any more.
+    bool adaptive_length = false;
+
+    // Of the integrand points, the last ones are held out of the search, and
+    // only looked at by the final check of the programs that pass the
+    // verifiers, in extended precision, along with all the others. With
+    // bottom-up search, the random candidates then skip no size.
+    std::size_t num_held_out = 0;
+
+    // Share of the random attempts of each worker spent on mutating the
+    // programs of lowest loss it has come across, rather than on composing
+    // new ones. Longer antiderivatives are then reached step by step from
+    // programs that are nearly right, and a share of 0.2 about halves the
+    // attempts to a program of size 8 to 10. The pools of programs are not
+    // saved to the checkpoint, so only a job with none resumes exactly.
+    double exploitation = 0.0;
+
+    // File that the workers save their state to as they go, and that a job
+    // submitted again, identical but for max_attempts, resumes from, to an
+    // engine of as many workers. Empty for none. The random streams carry on
+    // exactly where they stopped, and the chunks the workers had claimed but
+    // maybe not finished are enumerated again. Bottom-up search starts over.
+    std::string checkpoint_path{};
+
+    // File that the candidates whose loss is below near_miss_cutoff are
+    // appended to, as read back by read_near_misses, and that is closed once
+    // the last worker leaves the job. Empty for none. Only candidates about as
+    // close at the first point are verified at all, so a cutoff laxer than
+    // that of the verifiers makes for more verifications. The programs built
+    // bottom-up are not recorded.
+    std::string near_miss_path{};
+    double near_miss_cutoff = 0.0;
+  };
+
+  // Integrands sampled at the same xs, searched for with a single stream of
+  // candidates: each candidate is evaluated once, and matched against all of
+  // them at the same time.
+  struct BatchSearchJob {
+    std::vector<double> xs;
+    std::vector<std::vector<double>> integrands; // Their values at the xs
+    unsigned long max_attempts = 0; // For all of them, 0 means no limit
+    std::size_t exhaustive_size = 6;
+    Exhaustive exhaustive = Exhaustive::enumerated;
+    unsigned int partition = 0;
+    unsigned int num_partitions = 1;
+    int random_length = 20;
+    bool adaptive_length = false;
+    std::size_t num_held_out = 0; // Of the xs
+    double exploitation = 0.0;
+    std::string checkpoint_path{};
+    std::string near_miss_path{};
+    double near_miss_cutoff = 0.0;
+  };
+
+  // What the workers did with the candidates of a job so far. Each candidate
+  // is either skipped, not finite, rejected at the first point, or verified.
+  struct SearchStats {
+    unsigned long num_attempts = 0;
+    unsigned long num_resumed_attempts = 0; // Made before a checkpoint
+    unsigned long num_skipped = 0;    // Known to be wrong without evaluating
+    unsigned long num_non_finite = 0; // At the first x
+    unsigned long num_first_point_rejections = 0; // Near no integrand there
+    unsigned long num_verifications = 0; // By a Verifier, once per integrand
+    unsigned long num_unconfirmed = 0; // Verified, but failed the final check
+    unsigned long num_mutations = 0; // Attempts that mutated a program
+    unsigned long num_near_misses = 0; // Recorded to the near-miss log
+    unsigned long num_dropped_near_misses = 0; // As the log fell behind
+    // Attempts by size of the candidate
+    std::array<unsigned long, expr_max_size + 1> num_by_size{};
+  };
+
+  struct SearchResult {
+    std::string expr; // The antiderivative in RPN, empty if none was found
+    unsigned long num_attempts = 0;
+    bool cancelled = false;
+  };
+
+  struct SearchJobState;
+
+  // Returned by SearchEngine::submit, to follow and cancel a job.
+  class SearchHandle {
+  public:
+    std::future<SearchResult>& result() { return future; }
+
+    // Attempts made so far
+    unsigned long num_attempts() const;
+
+    // Summed over the workers, without stopping them, so that the figures
+    // may be a few candidates apart from one another.
+    SearchStats stats() const;
+
+    // Makes the workers give up the job within one candidate, or skip it if
+    // they haven't started it yet. The result reports the attempts made.
+    void cancel();
+
+  private:
+    friend class SearchEngine;
+
+    SearchHandle(std::shared_ptr<SearchJobState> job,
+                 std::future<SearchResult> future)
+      : job{std::move(job)}, future{std::move(future)}
+    { }
+
+    std::shared_ptr<SearchJobState> job;
+    std::future<SearchResult> future;
+  };
+
+  // Returned by SearchEngine::submit for a batch. Each integrand gets its
+  // result as soon as it is resolved, and the rest once the job is over.
+  class BatchSearchHandle {
+  public:
+    // In the order of the integrands of the job
+    std::vector<std::future<SearchResult>>& results() { return futures; }
+
+    // Same as SearchHandle::cancel, for the integrands still unresolved
+    void cancel();
+
+    SearchStats stats() const;
+
+  private:
+    friend class SearchEngine;
+
+    BatchSearchHandle(std::shared_ptr<SearchJobState> job,
+                      std::vector<std::future<SearchResult>> futures)
+      : job{std::move(job)}, futures{std::move(futures)}
+    { }
+
+    std::shared_ptr<SearchJobState> job;
+    std::vector<std::future<SearchResult>> futures;
+  };
+
+
+  // Where the workers of a SearchEngine run
+  enum class Placement {
+    floating,       // Wherever the OS schedules them
+    pinned,         // Worker i on logical CPU i, wrapping around
+    physical_cores, // Likewise, but one per physical core, socket after
+                    // socket, before any second hardware thread of a core
+  };
+
+  //////////////////////////////////////////////////////////////////////////////
+  // A pool of worker threads, each owning a Composer, that outlives any single
+  // search. Jobs are searched one after the other, each by all the workers at
+  // once, and the random streams of the workers carry on from one job to the
+  // next.
+  //
+  // A worker pins itself before allocating anything, and then allocates all
+  // it writes to, from its Composer to its copies of the integrand points in
+  // its verifiers. With the first-touch policy of Linux, its memory is hence
+  // on its own NUMA node.
+  //////////////////////////////////////////////////////////////////////////////
+
+  class SearchEngine {
+  public:
+    // With num_threads = 0, there is one worker per physical core.
+    SearchEngine(unsigned int num_threads, unsigned int seed,
+                 Placement placement = Placement::physical_cores);
+
+    // Cancels the pending jobs, and waits for the workers to exit.
+    ~SearchEngine();
+
+    SearchEngine(const SearchEngine&) = delete;
+    SearchEngine& operator=(const SearchEngine&) = delete;
+
+    // Throw like Checkpoint's constructor if the job has a checkpoint that
+    // can't be resumed, and like NearMissLog's if its log can't be opened.
+    SearchHandle submit(SearchJob job);
+    BatchSearchHandle submit(BatchSearchJob job);
+
+    unsigned int num_threads() const { return threads.size(); }
+
+  private:
+    struct Worker;
+
+    std::mutex mtx; // Guards the members below, up to the workers
+    std::condition_variable job_submitted;
+    std::deque<std::shared_ptr<SearchJobState>> jobs; // Not yet finished
+    uint64_t next_seq = 0; // Sequence number of the job to be submitted next
+    bool stopping = false;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    void work(unsigned int id, unsigned int seed, int cpu);
+    void run(unsigned int id, SearchJobState& job);
+    void save(unsigned int id, SearchJobState& job);
+    bool enumerate(unsigned int id, SearchJobState& job);
+    bool grow_bottom_up(unsigned int id, SearchJobState& job);
+    void leave(SearchJobState& job);
+  };
+
+
+  // Searches for an antiderivative of a single integrand with a fresh engine.
+  // Returns it (empty if not found) along with the number of attempts made.
+  std::pair<std::string, unsigned long>
+  search(const std::vector<Point>& integrand_points,
+         unsigned int seed,
+         unsigned int num_threads,
+         unsigned long max_attempts);
+
+} // namespace integrator
@@ -1,12 +1,26 @@
-#include "integrator.h"
+#include "search.h"
+#include "samples.h"
+#include "enumerator.h"
+#include "reporter.h"
 #include "reverse.h"
+#include "jit.h"
+#include "length_schedule.h"
+#include <array>
+#include <span>
 #include <cstdio>
+#include <cstdlib>
 #include <cmath>
-#include <algorithm>
-#include <span>
+#include <cstring>
 #include <chrono>
-#include <thread>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
 #include <mutex>
+#include <string>
+#include <string_view>
+#include <stdexcept>
 #include <fmt/format.h>
 
 
@@ -23,118 +37,362 @@ void stop_timer()
   fmt::print("{}\n", dur.count());
 }
 
-template<typename F>
-double derivative(const F& func, double x)
+// The function to be integrated when no samples are given
+double func(double x)
 {
-  constexpr double eps = std::numeric_limits<double>::epsilon();
-  double dx = std::cbrt(eps);
+  return x / std::tan(x);
+}
+
+constexpr auto usage = R"(usage: test [options] [FILE]
+
+Searches for antiderivatives of the integrands sampled in FILE, a table of
+rows `x y1 y2 ...`, or in the standard input if FILE is -, or of x / tan x
+if there is no FILE. The verifiers accept errors of about 1e-10 at most, so
+the values must be printed to full precision, e.g. with %.17g.
+
+  --seed N              seed of the random streams (4)
+  --threads N           workers, 0 for one per physical core (4)
+  --max-attempts N      for all the integrands, 0 for no limit (100000000)
+  --length N            random candidates are of 2 to N+1 draws (20)
+  --adaptive-length     favour the lengths of most new candidates per second
+  --exhaustive-size N   programs covered exhaustively first (6)
+  --exploitation S      share of the attempts spent on mutations (0)
+  --held-out N          last rows only used to check the results (0)
+  --checkpoint PATH     file to save the search to, and resume it from
+  --near-misses PATH    file to log the candidates of low loss to
+  --near-miss-cutoff C  largest loss logged, with --near-misses (1e-10)
+  --quiet               no progress on stderr
+  --self-test           check the components against each other, and exit
+)";
+
+// Failed checks of the self-test
+int num_failures = 0;
 
-  return (func(x+dx) - func(x-dx)) / (2.0*dx);
+void check(bool ok, std::string_view what)
+{
+  if (!ok) {
+    fmt::print(stderr, "FAILED: {}\n", what);
+    ++num_failures;
+  }
+}
+
+// The JIT must compute bit for bit what the interpreter does, and give up
+// on the same programs, at points where some of them are not finite.
+void check_jit()
+{
+  if (!integrator::Jit::is_supported) {
+    return;
+  }
+  using integrator::Evaluator;
+  constexpr auto xs = std::array{0.5, -1.3, 0.0, 2.0, 1e300, -0.25};
+  auto enumerator = integrator::Enumerator(5);
+  auto candidate = integrator::Candidate{};
+  auto jit = integrator::Jit{};
+  auto num_finite = 0ul, num_non_finite = 0ul;
+  enumerator.seek(0, candidate);
+  do {
+    auto code = candidate.bytecode();
+    if (!jit.compile(code)) {
+      check(false, fmt::format("jit compiles {}", candidate.to_string()));
+      continue;
+    }
+    for (auto x : xs) {
+      auto expected = Evaluator::eval_dual_checked(code, x);
+      auto dual = integrator::Dual{};
+      auto ok = jit.eval_batch_checked(std::span(&x, 1), std::span(&dual, 1));
+      auto same = ok == expected.has_value()
+        && (!ok || (std::memcmp(&dual.value, &expected->value,
+                                sizeof(double)) == 0
+                    && std::memcmp(&dual.deriv, &expected->deriv,
+                                   sizeof(double)) == 0));
+      check(same, fmt::format("jit agrees on {} at {}",
+                              candidate.to_string(), x));
+      ++(ok ? num_finite : num_non_finite);
+    }
+  } while (enumerator.next(candidate));
+  check(num_finite > 0 && num_non_finite > 0, "jit sees both kinds");
 }
 
-using Point = std::pair<double, double>;
+// A sink that throws must not leave the converting threads behind: the
+// exception comes out, and the threads are joined.
+void check_infix_lines()
+{
+  auto src = std::string{};
+  for (int i = 0; i < 1'000'000; ++i) {
+    src += "xS1+\n";
+  }
+  for (auto num_calls : {1, 2}) {
+    auto calls = 0;
+    auto sink = [&](std::string_view) {
+      if (++calls == num_calls) {
+        throw std::runtime_error("sink");
+      }
+    };
+    auto is_thrown = false;
+    try {
+      infix_from_reverse_polish_lines(src, sink, 2);
+    } catch (const std::runtime_error&) {
+      is_thrown = true;
+    }
+    check(is_thrown, "the exception of the sink comes out");
+  }
+}
 
-bool is_correct_integral(std::vector<integrator::MemberFuncPtr>& compiled_expr,
-                integrator::Composer& composer,
-                std::span<const Point> integrand_points)
+// The first report of a resumed job must only count the attempts made
+// since, not those of the checkpoint.
+void check_resumed_rate()
 {
-    constexpr auto loss_cutoff = 1.0e-10;
+  auto path = (std::filesystem::temp_directory_path()
+               / "integrator-self-test.checkpoint").string();
+  std::filesystem::remove(path);
+  auto make_job = [&path](unsigned long max_attempts) {
+    auto job = integrator::BatchSearchJob{};
+    job.xs = {0.3, 0.7, 1.1, 1.6, 2.1};
+    job.integrands.emplace_back();
+    for (auto x : job.xs) {
+      job.integrands.back().push_back(x * x * std::cos(x)); // Not found
+    }
+    job.max_attempts = max_attempts;
+    job.checkpoint_path = path;
+    return job;
+  };
+  auto run = [](integrator::SearchEngine& engine,
+                integrator::BatchSearchJob job) {
+    auto handle = engine.submit(std::move(job));
+    for (auto& result : handle.results()) {
+      result.wait();
+    }
+    return handle;
+  };
 
-    double loss = 0.0;
-    for (const auto& point : integrand_points) {
-      auto x = point.first;
-      auto y = point.second;
-      double pred_deriv = derivative([&composer, &compiled_expr](double x) {
-          return composer.eval(compiled_expr, x); },
-          x);
+  auto engine = integrator::SearchEngine(1, 4);
+  run(engine, make_job(1'000'000));
 
-      double delta = pred_deriv - y;
-      loss += delta * delta;
+  auto mtx = std::mutex{};
+  auto first = std::optional<integrator::Progress>{};
+  auto handle = engine.submit(make_job(2'000'000));
+  {
+    auto reporter = integrator::Reporter(
+        [&handle] { return handle.stats(); },
+        2'000'000,
+        [&](const integrator::Progress& progress) {
+          auto lk = std::scoped_lock{mtx};
+          if (!first) {
+            first = progress;
+          }
+        },
+        std::chrono::milliseconds(10));
+    for (auto& result : handle.results()) {
+      result.wait();
     }
+  }
+  std::filesystem::remove(path);
 
-    return loss < loss_cutoff;
+  check(first && first->stats.num_resumed_attempts > 0, "the job resumes");
+  if (first) {
+    const auto& stats = first->stats;
+    auto made = double(stats.num_attempts - stats.num_resumed_attempts);
+    check(first->rate * first->elapsed <= made * (1.0 + 1e-9) + 1.0,
+          "the first rate leaves out the resumed attempts");
+  }
 }
 
-// The function to be integrated
-double func(double x)
+// A length whose candidates are all the same program must be spent, which
+// lets the longest length go up.
+void check_length_schedule()
 {
-  return x / std::tan(x);
+  constexpr auto tentative_len = 10;
+  auto schedule = integrator::LengthSchedule(tentative_len, 4);
+  auto composer = integrator::Composer(4);
+  auto repeated = integrator::Candidate{};
+  composer.gen_random_code(integrator::LengthSchedule::min_len, repeated);
+  auto candidate = integrator::Candidate{};
+  for (int i = 0; i < 1'000'000; ++i) {
+    auto len = schedule.next();
+    if (len == integrator::LengthSchedule::min_len) {
+      schedule.verified(repeated);
+    } else {
+      composer.gen_random_code(len, candidate);
+      schedule.verified(candidate);
+    }
+  }
+  check(schedule.max_len() > tentative_len + 1,
+        "a length of a single program is spent");
 }
 
-std::pair<std::string, unsigned long>
-search(const std::vector<Point>& integrand_points,
-       unsigned int seed,
-       unsigned int num_threads,
-       unsigned long max_attempts)
+int self_test()
 {
-  auto result_mtx = std::mutex{};
-  auto result_str = std::string{};
-  auto num_attempts = 0ul;
+  check_jit();
+  check_infix_lines();
+  check_resumed_rate();
+  check_length_schedule();
+  fmt::print("{}\n", num_failures == 0 ? "ok" : "FAILED");
+  return num_failures == 0 ? 0 : 1;
+}
 
-  if (max_attempts == 0) {
-    max_attempts = std::numeric_limits<decltype(max_attempts)>::max();
+struct Options {
+  unsigned int seed = 4;
+  unsigned int num_threads = 4;
+  bool quiet = false;
+  std::string path; // Of the samples, empty for the built-in integrand
+  // Only applies to the job with a near-miss log, which it widens the
+  // search of.
+  double near_miss_cutoff = 1e-10;
+  integrator::BatchSearchJob job;
+};
+
+template<typename T>
+T parse(std::string_view option, std::string_view arg)
+{
+  auto value = T{};
+  auto [end, error] = std::from_chars(arg.data(), arg.data() + arg.size(),
+                                      value);
+  if (error != std::errc{} || end != arg.data() + arg.size()) {
+    throw std::invalid_argument(fmt::format("{}: bad value {}", option, arg));
   }
+  return value;
+}
 
-  auto searcher =
-    [&result_mtx, &result_str, &num_attempts, &max_attempts, &integrand_points]
-    (unsigned int seed)
-    {
-      integrator::Composer composer(seed);
-
-      constexpr auto N = 10000;
-      while (true) {
-        for (int attempt = 1; attempt < N; ++attempt) {
-          auto [raw_expr, compiled_expr] = composer.compose(20);
-          if (is_correct_integral(compiled_expr, composer, integrand_points)) {
-            auto lk = std::scoped_lock{result_mtx};
-            num_attempts += attempt;
-            if (result_str.empty()) {
-              result_str = raw_expr;
-            }
-            return;
-          }
-        }
-        auto lk = std::scoped_lock{result_mtx};
-        num_attempts += N;
-        if (!result_str.empty() || num_attempts > max_attempts) {
-          return;
-        }
-      }
+Options parse_options(int argc, char** argv)
+{
+  auto ret = Options{};
+  auto& job = ret.job;
+  job.max_attempts = 100'000'000ul;
 
-    };
+  for (int i = 1; i < argc; ++i) {
+    auto option = std::string_view(argv[i]);
+    if (option == "--quiet") {
+      ret.quiet = true;
+      continue;
+    }
+    if (option == "--adaptive-length") {
+      job.adaptive_length = true;
+      continue;
+    }
+    if (option == "--self-test") {
+      std::exit(self_test());
+    }
+    if (option == "-h" || option == "--help") {
+      fmt::print("{}", usage);
+      std::exit(0);
+    }
+    if (!option.starts_with("--")) {
+      if (!ret.path.empty()) {
+        throw std::invalid_argument("more than one FILE");
+      }
+      ret.path = option;
+      continue;
+    }
 
-  srand(seed);
-  auto workers = std::vector<std::thread>{};
-  for (auto i = 0u; i < num_threads; ++i) {
-    workers.emplace_back(std::thread(searcher, rand()));
+    if (i + 1 == argc) {
+      throw std::invalid_argument(fmt::format("{}: missing value", option));
+    }
+    auto arg = std::string_view(argv[++i]);
+    if (option == "--seed") {
+      ret.seed = parse<unsigned int>(option, arg);
+    } else if (option == "--threads") {
+      ret.num_threads = parse<unsigned int>(option, arg);
+    } else if (option == "--max-attempts") {
+      job.max_attempts = parse<unsigned long>(option, arg);
+    } else if (option == "--length") {
+      job.random_length = parse<int>(option, arg);
+      if (job.random_length < 1 || job.random_length > 31) {
+        throw std::invalid_argument("--length: must be within [1, 31]");
+      }
+    } else if (option == "--exhaustive-size") {
+      job.exhaustive_size = parse<std::size_t>(option, arg);
+      if (job.exhaustive_size > integrator::Enumerator::max_max_size) {
+        throw std::invalid_argument(fmt::format(
+            "--exhaustive-size: at most {}",
+            integrator::Enumerator::max_max_size));
+      }
+    } else if (option == "--held-out") {
+      job.num_held_out = parse<std::size_t>(option, arg);
+    } else if (option == "--exploitation") {
+      job.exploitation = parse<double>(option, arg);
+    } else if (option == "--checkpoint") {
+      job.checkpoint_path = arg;
+    } else if (option == "--near-misses") {
+      job.near_miss_path = arg;
+    } else if (option == "--near-miss-cutoff") {
+      ret.near_miss_cutoff = parse<double>(option, arg);
+    } else {
+      throw std::invalid_argument(fmt::format("unknown option {}", option));
+    }
   }
-
-  for (auto& t : workers) {
-    t.join();
+  if (!job.near_miss_path.empty()) {
+    job.near_miss_cutoff = ret.near_miss_cutoff;
   }
-
-  return {result_str, num_attempts};
+  return ret;
 }
 
-
-int main()
+// Fills in the xs and integrands of the job, from the samples if any.
+void load_samples(Options& options)
 {
-  std::vector<double> xs = {0.2, 0.5, 0.9, 1.5, 2.0};
-  auto points = std::vector<Point>{};
-  std::transform(xs.begin(), xs.end(),
-                 std::back_inserter(points),
-                 [](auto x) { return Point{x, func(x)}; });
+  auto samples = integrator::BatchSearchJob{};
+  if (options.path.empty()) {
+    samples.xs = {0.2, 0.5, 0.9, 1.5, 2.0};
+    samples.integrands.emplace_back();
+    for (auto x : samples.xs) {
+      samples.integrands.back().push_back(func(x));
+    }
+  } else if (options.path == "-") {
+    samples = integrator::read_samples(std::cin, "stdin");
+  } else {
+    auto in = std::ifstream(options.path);
+    if (!in) {
+      throw std::runtime_error(fmt::format("can't open {}", options.path));
+    }
+    samples = integrator::read_samples(in, options.path);
+  }
+  if (options.job.num_held_out >= samples.xs.size()) {
+    throw std::invalid_argument("--held-out: must leave some rows to search");
+  }
+  options.job.xs = std::move(samples.xs);
+  options.job.integrands = std::move(samples.integrands);
+}
 
+int main(int argc, char** argv)
+{
+  auto options = Options{};
+  try {
+    options = parse_options(argc, argv);
+    load_samples(options);
+  } catch (const std::exception& e) {
+    fmt::print(stderr, "{}\n\n{}", e.what(), usage);
+    return 2;
+  }
 
+  auto max_attempts = options.job.max_attempts;
   start_timer();
-  auto [str, attempts] = search(points, 4, 4, 100'000'000);
+  auto engine = integrator::SearchEngine(options.num_threads, options.seed);
+  auto handle = [&] {
+    try {
+      return engine.submit(std::move(options.job));
+    } catch (const std::exception& e) {
+      fmt::print(stderr, "{}\n", e.what());
+      std::exit(1);
+    }
+  }();
+  {
+    // Progress goes to stderr, once a second until the search is over.
+    auto reporter = std::optional<integrator::Reporter>{};
+    if (!options.quiet) {
+      reporter.emplace([&handle] { return handle.stats(); },
+                       max_attempts,
+                       integrator::print_progress());
+    }
+    for (auto& result : handle.results()) {
+      result.wait();
+    }
+  }
   stop_timer();
-  // auto [str, attempts] = search(points, 4, 8, 100'000'000);
-  fmt::print("{}\n{}\n", str, attempts);
-  if (!str.empty()) {
-    fmt::print("{}\n", infix_from_reverse_polish(str));
+  for (auto& result : handle.results()) {
+    auto [str, attempts, cancelled] = result.get();
+    fmt::print("{}\n{}\n", str, attempts);
+    if (!str.empty()) {
+      fmt::print("{}\n", infix_from_reverse_polish(str));
+    }
   }
 
 }
-
-
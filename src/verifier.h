@@ -0,0 +1,305 @@
+#pragma once
+
+#include "integrator.h"
+#include "jit.h"
+#include <vector>
+#include <utility>
+#include <span>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+
+namespace integrator {
+
+  // Step of the central-difference derivative
+  inline double derivative_step()
+  {
+    constexpr double eps = std::numeric_limits<double>::epsilon();
+    return std::cbrt(eps);
+  }
+
+  template<typename F>
+  double derivative(const F& func, double x)
+  {
+    double dx = derivative_step();
+
+    return (func(x+dx) - func(x-dx)) / (2.0*dx);
+  }
+
+  using Point = std::pair<double, double>;
+
+  // Returns the x values sampled by the derivative stencil, packed so that
+  // they can be evaluated in a single batch: x-dx followed by x+dx for each
+  // point.
+  inline std::vector<double>
+  stencil_of(std::span<const Point> integrand_points)
+  {
+    auto dx = derivative_step();
+    auto stencil = std::vector<double>{};
+    for (const auto& point : integrand_points) {
+      stencil.push_back(point.first - dx);
+      stencil.push_back(point.first + dx);
+    }
+    return stencil;
+  }
+
+  enum class Differentiation {
+    central_difference, // Two evaluations per point, with truncation error
+    automatic,          // One evaluation on dual numbers per point, exact
+  };
+
+  // Largest loss of an accepted candidate. Exact derivatives afford a much
+  // tighter cutoff, which lets through far fewer false positives.
+  inline double loss_cutoff(Differentiation differentiation)
+  {
+    switch (differentiation) {
+      case Differentiation::central_difference:
+        return 1.0e-10;
+      case Differentiation::automatic:
+        return 1.0e-20;
+    }
+    assert(false);
+  }
+
+  // The final test of a program that passed a Verifier: its derivative, in
+  // extended precision, must still be within the cutoff of automatic
+  // differentiation at all the points, which may include some that the
+  // search never looked at. It catches the programs that only match at the
+  // points searched, or only as rounded in double.
+  inline bool is_confirmed(BytecodeView compiled_expr,
+                           std::span<const Point> points)
+  {
+    long double loss = 0.0;
+    for (const auto& [x, y] : points) {
+      auto dual = Evaluator::eval_dual_checked<long double>(compiled_expr, x);
+      if (!dual) {
+        return false;
+      }
+      long double delta = dual->deriv - y;
+      loss += delta * delta;
+    }
+    return loss < loss_cutoff(Differentiation::automatic);
+  }
+
+  enum class PointOrder {
+    as_given, // Test the points in the order they were given
+    adaptive, // Test first the point that rejects the most candidates alone
+  };
+
+  enum class Backend {
+    interpreter, // Evaluator, for everything
+    jit,         // Native code for the second stage, if it compiles
+  };
+
+  // Decides whether a candidate is an antiderivative of the integrand, in two
+  // stages: the first point is tested on its own, and the remaining points are
+  // only evaluated, in a single batch, for the rare candidates that survive it.
+  // Both stages reject a candidate as soon as it yields a non-finite value.
+  class Verifier {
+  public:
+    Verifier(std::span<const Point> integrand_points,
+             Differentiation differentiation = Differentiation::automatic,
+             PointOrder point_order = PointOrder::adaptive,
+             Backend backend = Backend::interpreter)
+      : points(integrand_points.begin(), integrand_points.end()),
+      differentiation{differentiation},
+      cutoff{loss_cutoff(differentiation)},
+      point_order{point_order},
+      backend{backend},
+      num_rejections(points.size())
+    {
+      assert(!points.empty());
+      for (std::size_t i = 0; i < points.size(); ++i) {
+        order.push_back(i);
+      }
+      all_points = make_stage(order);
+      update_stages();
+    }
+
+    bool is_correct_integral(BytecodeView compiled_expr)
+    {
+      if (point_order == PointOrder::adaptive
+          && ++num_candidates % sampling_interval == 0) {
+        return sample(compiled_expr);
+      }
+
+      double loss = 0.0;
+      return passes(compiled_expr, stage_one, loss)
+        && passes(compiled_expr, stage_two, loss);
+    }
+
+    // Sum of the squared errors at all the points, however large, and NaN if
+    // the candidate is not finite at one of them.
+    double loss(BytecodeView compiled_expr)
+    {
+      if (!differentiate<true>(compiled_expr, all_points)) {
+        return std::numeric_limits<double>::quiet_NaN();
+      }
+
+      double loss = 0.0;
+      for (std::size_t i = 0; i < points.size(); ++i) {
+        double delta = all_points.derivs[i] - all_points.ys[i];
+        loss += delta * delta;
+      }
+      return loss;
+    }
+
+  private:
+    // One candidate in sampling_interval is tested against every point, to
+    // estimate how often each point would reject candidates on its own. It is
+    // evaluated unchecked, so that all points get an opinion.
+    static constexpr auto sampling_interval = 1024u;
+    // Number of samples between two updates of the order of the points.
+    static constexpr auto reordering_interval = 256u;
+
+    // Points tested together, and the scratch space for their evaluation
+    struct Stage {
+      std::vector<double> ys;
+      std::vector<double> xs;          // Where automatic differentiation looks
+      std::vector<double> stencil;     // Where central differences look
+      std::vector<double> values;      // Of the candidate on the stencil
+      std::vector<Dual> duals; // Of the candidate on the xs
+      std::vector<double> derivs;      // Of the candidate on the xs
+      bool is_native = false;          // Whether to evaluate with the JIT
+    };
+
+    std::vector<Point> points;
+    Differentiation differentiation;
+    double cutoff;
+    PointOrder point_order;
+    Backend backend;
+    Jit jit;
+    std::vector<std::size_t> order; // Indices into points, in testing order
+    std::vector<unsigned long> num_rejections; // Per point, among the samples
+    unsigned long num_candidates = 0;
+    unsigned long num_samples = 0;
+
+    Stage stage_one, stage_two; // order[0], and order[1..]
+    Stage all_points;           // In the given order
+
+    Stage make_stage(std::span<const std::size_t> indices)
+    {
+      auto stage_points = std::vector<Point>{};
+      for (auto i : indices) {
+        stage_points.push_back(points[i]);
+      }
+
+      auto stage = Stage{};
+      for (const auto& [x, y] : stage_points) {
+        stage.xs.push_back(x);
+        stage.ys.push_back(y);
+      }
+      stage.stencil = stencil_of(stage_points);
+      stage.values.resize(stage.stencil.size());
+      stage.duals.resize(stage.xs.size());
+      stage.derivs.resize(stage.xs.size());
+      return stage;
+    }
+
+    void update_stages()
+    {
+      stage_one = make_stage(std::span(order).first(1));
+      stage_two = make_stage(std::span(order).subspan(1));
+      // The JIT only emits dual numbers.
+      stage_two.is_native = backend == Backend::jit
+        && differentiation == Differentiation::automatic;
+    }
+
+    // Evaluates the derivative of the candidate at the points of the stage.
+    template<bool checked>
+    bool differentiate(BytecodeView compiled_expr, Stage& stage)
+    {
+      if (differentiation == Differentiation::automatic) {
+        if constexpr (checked) {
+          if (stage.is_native && jit.compile(compiled_expr)) {
+            if (!jit.eval_batch_checked(stage.xs, stage.duals)) {
+              return false;
+            }
+          } else if (!Evaluator::eval_batch_checked(compiled_expr, stage.xs,
+                                                    std::span(stage.duals))) {
+            return false;
+          }
+        } else {
+          Evaluator::eval_batch(compiled_expr, stage.xs,
+                                std::span(stage.duals));
+        }
+
+        // Unchecked, a non-finite value may still come with a finite
+        // derivative, which must not pass.
+        for (std::size_t i = 0; i < stage.xs.size(); ++i) {
+          const auto& dual = stage.duals[i];
+          stage.derivs[i] = std::isfinite(dual.value)
+            ? dual.deriv
+            : std::numeric_limits<double>::quiet_NaN();
+        }
+      } else {
+        if constexpr (checked) {
+          if (!Evaluator::eval_batch_checked(compiled_expr, stage.stencil,
+                                             std::span(stage.values))) {
+            return false;
+          }
+        } else {
+          Evaluator::eval_batch(compiled_expr, stage.stencil,
+                                std::span(stage.values));
+        }
+
+        double dx = derivative_step();
+        for (std::size_t i = 0; i < stage.xs.size(); ++i) {
+          stage.derivs[i] =
+            (stage.values[2*i+1] - stage.values[2*i]) / (2.0*dx);
+        }
+      }
+
+      return true;
+    }
+
+    // Adds the loss of the stage to `loss`, and tells whether it is still below
+    // the cutoff. NaN losses fail every comparison, hence the !(<).
+    bool passes(BytecodeView compiled_expr,
+                Stage& stage,
+                double& loss)
+    {
+      if (!differentiate<true>(compiled_expr, stage)) {
+        return false;
+      }
+
+      for (std::size_t i = 0; i < stage.xs.size(); ++i) {
+        double delta = stage.derivs[i] - stage.ys[i];
+        loss += delta * delta;
+        if (!(loss < cutoff)) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    bool sample(BytecodeView compiled_expr)
+    {
+      differentiate<false>(compiled_expr, all_points);
+
+      double loss = 0.0;
+      for (std::size_t i = 0; i < points.size(); ++i) {
+        double delta = all_points.derivs[i] - all_points.ys[i];
+        if (!(delta * delta < cutoff)) {
+          ++num_rejections[i];
+        }
+        loss += delta * delta;
+      }
+
+      if (++num_samples % reordering_interval == 0) {
+        std::stable_sort(order.begin(), order.end(),
+                         [this](auto i, auto j) {
+                           return num_rejections[i] > num_rejections[j];
+                         });
+        update_stages();
+      }
+
+      return loss < cutoff;
+    }
+  };
+
+
+} // namespace integrator